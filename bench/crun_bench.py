@@ -0,0 +1,408 @@
+#!/usr/bin/env python3
+# crun_bench.py - Measures the end-to-end overhead crun adds on top of the bare compiler.
+# crun_bench.py - crunが素のコンパイラ呼び出しに対して上乗せする時間を計測します。
+#
+# Every scenario is run twice: once through crun (compile + run + cleanup) and once as
+# the equivalent bare compiler command followed by running the produced binary and
+# removing it. The difference between the two is crun's own overhead.
+# 各シナリオは crun 経由と、同等の素のコンパイラコマンド（コンパイル→実行→削除）の
+# 両方で実行され、その差分を crun 自身のオーバーヘッドとして記録します。
+#
+# Linux only. crun itself is a Windows executable, so on Linux it is normally invoked
+# through Wine (the default for --crun). The baseline uses the same launcher and the
+# same MinGW compiler (gcc.exe / g++.exe / clang.exe / clang++.exe on Wine's PATH) and
+# runs the resulting .exe the same way, so Wine and the toolchain cancel out.
+# Standard library only; no extra packages.
+# Linux専用です。crun本体はWindows実行ファイルなので、通常はWine経由で起動します。
+# ベースラインも同じランチャーと同じMinGWコンパイラを使い、生成した.exeを同じ方法で
+# 実行するため、Wineとツールチェーンの差は差分に含まれません。
+
+import argparse
+import json
+import os
+import platform
+import shlex
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TEST_DIR = os.path.join(REPO_ROOT, "test")
+
+# Windows のコマンドラインの上限 (CreateProcessW)
+MAX_COMMAND_LINE = 32767
+
+# crun のヘッダ -> リンクフラグの表 (src/crun.cpp の g_auto_link_rules と同じ内容)
+AUTO_LINK_RULES = [
+    ("<windows.h>", ["-lkernel32", "-luser32", "-lshell32", "-lgdi32", "-lwinspool", "-lcomdlg32", "-ladvapi32"]),
+    ("<winsock2.h>", ["-lws2_32"]),
+    ("<winsock.h>", ["-lws2_32"]),
+    ("<shlobj.h>", ["-lole32"]),
+    ("<dwmapi.h>", ["-ldwmapi"]),
+    ("<pthread.h>", ["-lpthread"]),
+    ("<math.h>", ["-lm"]),
+]
+
+# --- Scenario Definitions ---
+# --- シナリオ定義 ---
+# name -> (description, C++?)  description の {many_count} などはコマンドライン引数で置き換える
+SCENARIOS = {
+    "hello_c":       ("test/hello.c", False),
+    "hello_cpp":     ("test/hello.cpp", True),
+    "multi_file":    ("test/main.c + test/helper.c", False),
+    "many_sources":  ("{many_count:,} generated translation units", False),
+    "big_source":    ("single generated source of {big_mb} MB", False),
+    "include_chain": ("chain of {include_depth} local #include files", False),
+}
+
+
+# --- Input Generation ---
+# --- 入力ファイルの生成 ---
+def generate_many_sources(work_dir, count):
+    src_dir = os.path.join(work_dir, "many")
+    os.makedirs(src_dir, exist_ok=True)
+    files = []
+    # main を最初に置く（crunは最初のソース名から実行ファイル名を決める）
+    main_path = os.path.join(src_dir, "m.c")
+    with open(main_path, "w") as f:
+        f.write("#include <stdio.h>\n")
+        for i in range(count - 1):
+            f.write("int f%d(void);\n" % i)
+        f.write("int main(void) {\n    long s = 0;\n")
+        for i in range(count - 1):
+            f.write("    s += f%d();\n" % i)
+        f.write('    printf("%ld\\n", s);\n    return 0;\n}\n')
+    files.append(main_path)
+    for i in range(count - 1):
+        path = os.path.join(src_dir, "s%d.c" % i)
+        with open(path, "w") as f:
+            f.write("int f%d(void) { return %d; }\n" % (i, i))
+        files.append(path)
+    return files
+
+
+def generate_big_source(work_dir, size_mb):
+    # 大半はコメントで埋める。コンパイラ側の負荷は小さく、crunのファイル読み込み・解析が支配的になる。
+    path = os.path.join(work_dir, "big.c")
+    target = size_mb * 1024 * 1024
+    line = "/* padding line to exercise crun's source reading and header scanning paths. */\n"
+    header = "#include <stdio.h>\n#include <math.h>\n"
+    footer = 'int main(void) { printf("%f\\n", sqrt(2.0)); return 0; }\n'
+    with open(path, "w") as f:
+        f.write(header)
+        written = len(header) + len(footer)
+        block = line * 1024
+        while written + len(block) <= target:
+            f.write(block)
+            written += len(block)
+        while written + len(line) <= target:
+            f.write(line)
+            written += len(line)
+        f.write(footer)
+    return [path]
+
+
+def generate_include_chain(work_dir, depth):
+    chain_dir = os.path.join(work_dir, "chain")
+    os.makedirs(chain_dir, exist_ok=True)
+    for i in range(depth):
+        with open(os.path.join(chain_dir, "h%d.h" % i), "w") as f:
+            f.write("#ifndef H%d\n#define H%d\n" % (i, i))
+            if i + 1 < depth:
+                f.write('#include "h%d.h"\n' % (i + 1))
+            f.write("static inline int v%d(void) { return %d; }\n#endif\n" % (i, i))
+    path = os.path.join(chain_dir, "chain.c")
+    with open(path, "w") as f:
+        f.write('#include <stdio.h>\n#include "h0.h"\n')
+        f.write('int main(void) { printf("%%d\\n", v%d()); return 0; }\n' % (depth - 1))
+    return [path]
+
+
+def scenario_sources(name, work_dir, args):
+    if name == "hello_c":
+        return [os.path.join(TEST_DIR, "hello.c")]
+    if name == "hello_cpp":
+        return [os.path.join(TEST_DIR, "hello.cpp")]
+    if name == "multi_file":
+        return [os.path.join(TEST_DIR, "main.c"), os.path.join(TEST_DIR, "helper.c")]
+    if name == "many_sources":
+        return generate_many_sources(work_dir, args.many_count)
+    if name == "big_source":
+        return generate_big_source(work_dir, args.big_mb)
+    if name == "include_chain":
+        return generate_include_chain(work_dir, args.include_depth)
+    raise ValueError(name)
+
+
+# --- Command Construction ---
+# --- コマンドの構築 ---
+# ソースは共通のディレクトリを作業ディレクトリにして相対パスで渡す。
+# (many_sources の1,000ファイルを絶対パスで渡すとWindowsのコマンドラインの上限を超えるため)
+def source_args(args, sources):
+    cwd = os.path.commonpath([os.path.dirname(s) for s in sources])
+    rel = [os.path.relpath(s, cwd) for s in sources]
+    return cwd, [r.replace("/", "\\") for r in rel] if args.wine_paths else rel
+
+
+def launcher(args):
+    # --crun の最後の要素より前 (例: "wine") をベースラインでもそのまま使う
+    return shlex.split(args.crun)[:-1]
+
+
+def crun_command(args, rel_sources):
+    cmd = shlex.split(args.crun) + ["--compiler", args.compiler]
+    return cmd + rel_sources
+
+
+def auto_link_flags(sources):
+    # crun と同じく、ソースに含まれるヘッダからリンクフラグを決める
+    flags = []
+    for s in sources:
+        with open(s, "r", errors="replace") as f:
+            text = f.read()
+        for header, libs in AUTO_LINK_RULES:
+            if header in text:
+                flags += [l for l in libs if l not in flags]
+    return flags
+
+
+def to_crun_path(args, path):
+    # Wine 経由の場合、Linuxのパスは Z: ドライブとして見える
+    if args.wine_paths:
+        return "Z:" + path.replace("/", "\\")
+    return path
+
+
+def baseline_compiler(args, is_cpp):
+    # 既定では crun が使うのと同じコンパイラ (ランチャー経由の gcc.exe など)。--cc/--cxx で上書きできる
+    override = args.cxx if is_cpp else args.cc
+    if override:
+        return shlex.split(override)
+    if args.compiler == "gcc":
+        exe = "g++.exe" if is_cpp else "gcc.exe"
+    else:
+        exe = "clang++.exe" if is_cpp else "clang.exe"
+    return launcher(args) + [exe]
+
+
+class Scenario:
+    def __init__(self, name, args, sources, is_cpp, out_dir):
+        self.cwd, rel_sources = source_args(args, sources)
+        self.crun_cmd = crun_command(args, rel_sources)
+        # crun の既定フラグ (-O2 -s) と、ヘッダから自動追加されるリンクフラグに合わせる
+        self.exe = os.path.join(out_dir, "bench_baseline.exe")
+        # --cc/--cxx で上書きしたコンパイラはネイティブとみなし、パスの変換もランチャーも使わない
+        override = args.cxx if is_cpp else args.cc
+        exe_arg = self.exe if override else to_crun_path(args, self.exe)
+        self.baseline_cmd = (baseline_compiler(args, is_cpp) + rel_sources +
+                             ["-o", exe_arg, "-O2", "-s"] + auto_link_flags(sources))
+        self.run_cmd = [self.exe] if override else launcher(args) + [self.exe]
+        length = sum(len(a) + 3 for a in self.crun_cmd)
+        if length > MAX_COMMAND_LINE:
+            raise ValueError("%s: command line is %d characters (limit %d); lower the source count"
+                             % (name, length, MAX_COMMAND_LINE))
+
+
+def run_baseline(scenario):
+    start = time.perf_counter()
+    subprocess.run(scenario.baseline_cmd, cwd=scenario.cwd, check=True,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    subprocess.run(scenario.run_cmd, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    os.remove(scenario.exe)
+    return (time.perf_counter() - start) * 1000.0
+
+
+def run_crun(scenario):
+    start = time.perf_counter()
+    subprocess.run(scenario.crun_cmd, cwd=scenario.cwd, check=True,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return (time.perf_counter() - start) * 1000.0
+
+
+def drop_page_cache():
+    # root 権限がある場合のみ有効。失敗しても計測は続行する。
+    try:
+        subprocess.run(["sync"], check=False)
+        with open("/proc/sys/vm/drop_caches", "w") as f:
+            f.write("3\n")
+        return True
+    except OSError:
+        return False
+
+
+# --- Measurement ---
+# --- 計測 ---
+def summarize(samples):
+    return {
+        "runs": len(samples),
+        "min_ms": round(min(samples), 3),
+        "median_ms": round(statistics.median(samples), 3),
+        "mean_ms": round(statistics.mean(samples), 3),
+        "stdev_ms": round(statistics.stdev(samples), 3) if len(samples) > 1 else 0.0,
+    }
+
+
+def measure(args, scenario):
+    # cold は crun を先に実行する (入力を最初に読むのが crun になるように)。
+    # --drop-caches がない場合、ベースラインの cold は crun が温めたページキャッシュの上で動くため、
+    # cold のオーバーヘッドは上限値として扱う。
+    runners = (("crun", run_crun), ("baseline", run_baseline))
+    results = {}
+    for label, runner in runners:
+        cache_dropped = drop_page_cache() if args.drop_caches else False
+        results[label] = {"cold_ms": round(runner(scenario), 3), "cache_dropped": cache_dropped}
+    for _ in range(args.warmup):
+        for _, runner in runners:
+            runner(scenario)
+    # warm は交互に実行し、計測中の負荷の変化が両方に同じように効くようにする
+    warm = {label: [] for label, _ in runners}
+    for _ in range(args.runs):
+        for label, runner in runners:
+            warm[label].append(runner(scenario))
+    for label, _ in runners:
+        results[label]["warm"] = summarize(warm[label])
+    return results
+
+
+def bench_scenario(name, args, work_dir):
+    _, is_cpp = SCENARIOS[name]
+    sources = scenario_sources(name, work_dir, args)
+    out_dir = os.path.join(work_dir, "out_" + name)
+    os.makedirs(out_dir, exist_ok=True)
+    result = {
+        "description": SCENARIOS[name][0].format(many_count=args.many_count, big_mb=args.big_mb,
+                                                  include_depth=args.include_depth),
+        "sources": len(sources),
+        "bytes": sum(os.path.getsize(s) for s in sources),
+    }
+    try:
+        scenario = Scenario(name, args, sources, is_cpp, out_dir)
+        result["baseline_command"] = " ".join(scenario.baseline_cmd[:8]) + (" ..." if len(scenario.baseline_cmd) > 8 else "")
+        measured = measure(args, scenario)
+        result["crun"] = measured["crun"]
+        result["baseline"] = measured["baseline"]
+    except (subprocess.CalledProcessError, OSError, ValueError) as e:
+        result["error"] = str(e)
+        return result
+    base = result["baseline"]["warm"]["median_ms"]
+    over = result["crun"]["warm"]["median_ms"] - base
+    result["overhead_ms"] = round(over, 3)
+    result["overhead_pct"] = round(over * 100.0 / base, 2) if base > 0 else None
+    result["cold_overhead_ms"] = round(result["crun"]["cold_ms"] - result["baseline"]["cold_ms"], 3)
+    result["cold_overhead_is_upper_bound"] = not result["baseline"]["cache_dropped"]
+    return result
+
+
+# --- Regression Check ---
+# --- 回帰チェック ---
+def check_regressions(current, previous, threshold_pct, min_delta_ms):
+    # オーバーヘッド（中央値）が閾値を超えて増えたシナリオを列挙する
+    regressions = []
+    for name, cur in current["scenarios"].items():
+        prev = previous.get("scenarios", {}).get(name)
+        if not prev or "overhead_ms" not in prev or "overhead_ms" not in cur:
+            continue
+        prev_over, cur_over = prev["overhead_ms"], cur["overhead_ms"]
+        delta = cur_over - prev_over
+        limit = max(abs(prev_over) * threshold_pct / 100.0, min_delta_ms)
+        if delta > limit:
+            regressions.append((name, prev_over, cur_over))
+    return regressions
+
+
+def parse_args():
+    p = argparse.ArgumentParser(description="Benchmark crun's overhead against the bare compiler.")
+    p.add_argument("--crun", default="wine " + os.path.join(REPO_ROOT, "bin", "crun.exe"),
+                   help="command used to invoke crun (default: 'wine bin/crun.exe')")
+    p.add_argument("--no-wine-paths", dest="wine_paths", action="store_false",
+                   help="pass Linux paths to crun unchanged instead of Z:\\ paths")
+    p.add_argument("--compiler", choices=("gcc", "clang"), default="gcc")
+    p.add_argument("--cc", help="override the baseline C compiler command "
+                                "(default: the launcher from --crun + gcc.exe or clang.exe)")
+    p.add_argument("--cxx", help="override the baseline C++ compiler command "
+                                 "(default: the launcher from --crun + g++.exe or clang++.exe)")
+    p.add_argument("--scenarios", default=",".join(SCENARIOS),
+                   help="comma-separated subset of: " + ", ".join(SCENARIOS))
+    p.add_argument("--runs", type=int, default=5, help="warm runs per scenario")
+    p.add_argument("--warmup", type=int, default=1, help="discarded runs between cold and warm")
+    p.add_argument("--drop-caches", action="store_true",
+                   help="drop the page cache before each cold run (needs root)")
+    p.add_argument("--many-count", type=int, default=1000)
+    p.add_argument("--big-mb", type=int, default=50)
+    p.add_argument("--include-depth", type=int, default=150)
+    p.add_argument("--output", "-o", default="bench_output.json")
+    p.add_argument("--compare", help="previous JSON result to check for regressions against")
+    p.add_argument("--threshold", type=float, default=10.0,
+                   help="allowed overhead growth in percent (default: 10)")
+    p.add_argument("--min-delta-ms", type=float, default=5.0,
+                   help="ignore overhead growth smaller than this (default: 5 ms)")
+    p.add_argument("--keep-inputs", action="store_true", help="keep the generated inputs")
+    return p.parse_args()
+
+
+def main():
+    if not sys.platform.startswith("linux"):
+        print("Error: crun_bench.py runs on Linux only.", file=sys.stderr)
+        return 2
+    args = parse_args()
+    names = [n.strip() for n in args.scenarios.split(",") if n.strip()]
+    for n in names:
+        if n not in SCENARIOS:
+            print("Error: Unknown scenario '%s'." % n, file=sys.stderr)
+            return 2
+    if args.runs < 1:
+        print("Error: --runs must be at least 1.", file=sys.stderr)
+        return 2
+
+    work_dir = tempfile.mkdtemp(prefix="crun_bench_")
+    results = {
+        "meta": {
+            "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "host": platform.node(),
+            "kernel": platform.release(),
+            "crun": args.crun,
+            "compiler": args.compiler,
+            "runs": args.runs,
+        },
+        "scenarios": {},
+    }
+    try:
+        for name in names:
+            print("[%s] %s ..." % (name, SCENARIOS[name][0]), flush=True)
+            r = bench_scenario(name, args, work_dir)
+            results["scenarios"][name] = r
+            if "error" in r:
+                print("    failed: %s" % r["error"])
+            else:
+                print("    baseline %.1f ms, crun %.1f ms, overhead %+.1f ms (cold %+.1f ms)" % (
+                    r["baseline"]["warm"]["median_ms"], r["crun"]["warm"]["median_ms"],
+                    r["overhead_ms"], r["cold_overhead_ms"]))
+    finally:
+        if args.keep_inputs:
+            print("Inputs kept in %s" % work_dir)
+        else:
+            shutil.rmtree(work_dir, ignore_errors=True)
+
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2)
+    print("Results written to %s" % args.output)
+
+    status = 1 if any("error" in r for r in results["scenarios"].values()) else 0
+    if args.compare:
+        with open(args.compare) as f:
+            previous = json.load(f)
+        regressions = check_regressions(results, previous, args.threshold, args.min_delta_ms)
+        for name, prev_over, cur_over in regressions:
+            print("REGRESSION [%s]: overhead %.1f ms -> %.1f ms" % (name, prev_over, cur_over))
+        if regressions:
+            status = 1
+        else:
+            print("No regressions against %s (threshold %.1f%%)." % (args.compare, args.threshold))
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <wchar.h>
 #include <string.h>
+#include <math.h>
 
 #pragma comment(lib, "shell32.lib") // SHFileOperationW のためにリンク
 
@@ -39,8 +40,12 @@ BOOL WINAPI ConsoleCtrlHandler(DWORD ctrl_type) {
 void fwprintf_err(const wchar_t* format, ...);
 BOOL file_exists(const wchar_t* path);
 BOOL run_process(wchar_t* command_line, BOOL verbose);
+BOOL start_process(wchar_t* command_line, BOOL verbose, HANDLE h_output, HANDLE* p_process);
+int run_commands_parallel(wchar_t** commands, int num_commands, int jobs, BOOL verbose, BOOL* succeeded, wchar_t** output_paths);
+int get_cpu_count();
 BOOL run_program_and_get_exit_code(wchar_t* command_line, DWORD* p_exit_code);
 BOOL run_process_and_capture_output(wchar_t* command_line, wchar_t** output);
+void print_output_file(const wchar_t* path);
 BOOL find_executable_in_path(const wchar_t* exe_name, wchar_t* out_path, size_t out_path_size);
 void get_parent_path(const wchar_t* path, wchar_t* parent_path, size_t parent_path_size);
 const wchar_t* get_extension(const wchar_t* path);
@@ -48,6 +53,8 @@ void get_stem(const wchar_t* path, wchar_t* stem, size_t stem_size);
 BOOL remove_directory_recursively(const wchar_t* path);
 BOOL read_file_content_wide(const wchar_t* path, wchar_t** content);
 void clean_temp_directories(const wchar_t* target_dir);
+void get_compiler_exe_name(const wchar_t* compiler_name, BOOL has_cpp, wchar_t* out_name, size_t out_name_size);
+const wchar_t* get_filename(const wchar_t* path);
 
 // --- Options Structure ---
 // --- プログラム設定を保持する構造体 ---
@@ -63,8 +70,201 @@ struct ProgramOptions {
     BOOL measure_time;         // 実行時間を計測するか
     BOOL warnings_all;         // 全ての警告を有効にするか
     BOOL debug_build;          // デバッグビルドを有効にするか
+    BOOL compiler_explicit;    // --compiler が明示的に指定されたか
+    BOOL tune;                 // 自動チューニングモード (--tune)
+    const wchar_t* tune_config; // チューニング設定ファイル (--tune-config)
+    BOOL size_report;          // サイズ・起動コストのレポート (--size-report)
+    BOOL size_report_static;   // 静的リンク版との比較を行うか (--size-report-static)
+    const wchar_t* size_report_json; // レポートのJSON出力先 (--size-report-json)
 };
 
+// --- Tuning ---
+// --- 自動チューニング (--tune) ---
+#define TUNE_MAX_VALUES 8
+#define TUNE_MAX_CANDIDATES 256
+
+// チューニングで試す構成の組み合わせ
+struct TuneConfig {
+    wchar_t compilers[TUNE_MAX_VALUES][16]; // "gcc", "clang"
+    int num_compilers;
+    wchar_t opt_levels[TUNE_MAX_VALUES][16]; // "-O2", "-O3", "-Os", ...
+    int num_opt_levels;
+    BOOL march_native[2]; int num_march_native; // -march=native の有無
+    BOOL unroll_loops[2]; int num_unroll_loops; // -funroll-loops の有無
+    BOOL lto[2]; int num_lto;                   // -flto の有無
+    int runs;                  // 各バイナリの計測回数
+    int jobs;                  // 並列ビルド数 (0 = CPUコア数)
+};
+
+// チューニング候補1件分のビルド・計測結果
+struct TuneCandidate {
+    const wchar_t* compiler_name;
+    wchar_t flags[128];
+    wchar_t exe_path[MAX_PATH];
+    BOOL built;
+    BOOL run_failed;           // 計測中に終了コード0以外で終了した (クラッシュを含む)
+    DWORD exit_code;           // run_failed のときの終了コード
+    double mean_ms;
+    double ci_ms;              // 95%信頼区間の半幅
+    double min_ms;
+};
+
+void load_tune_config(const wchar_t* config_path, TuneConfig* cfg);
+int run_tune(const ProgramOptions* opts, BOOL has_cpp, const wchar_t* all_source_files_str, const wchar_t* lib_flags,
+             const wchar_t* temp_dir, const wchar_t* program_args_str, const wchar_t* profile_path, const wchar_t* profile_section);
+
+// --- Size Report ---
+// --- サイズ・起動コストのレポート (--size-report) ---
+#define SIZE_REPORT_MAX_SECTIONS 96
+#define SIZE_REPORT_MAX_IMPORTS 32
+#define SIZE_REPORT_TOP_SYMBOLS 15
+#define SIZE_REPORT_PROBE_RUNS 10
+
+// PEセクション1つ分の情報
+struct SectionInfo {
+    char name[64];
+    DWORD virtual_size;
+    DWORD raw_size;
+    BOOL is_debug;             // strip で削除されるデバッグ情報セクションか
+};
+
+// シンボル1つ分の情報 (サイズは次のシンボルまでの距離から推定)
+struct SymbolInfo {
+    char name[128];
+    char section[16];
+    DWORD size;
+};
+
+// ビルドした実行ファイル1つ分 (動的/静的リンク) のレポート
+struct SizeReport {
+    const wchar_t* label;      // "dynamic" or "static"
+    BOOL built;
+    DWORD file_size;           // シンボル表を含むファイルサイズ
+    DWORD stripped_size;       // strip 後のサイズ (推定)
+    SectionInfo sections[SIZE_REPORT_MAX_SECTIONS];
+    int num_sections;
+    SymbolInfo top_symbols[SIZE_REPORT_TOP_SYMBOLS];
+    int num_top_symbols;
+    int num_symbols;
+    char imports[SIZE_REPORT_MAX_IMPORTS][64]; // インポートしているDLL
+    int num_imports;
+    BOOL has_time_to_main;
+    double time_to_main_us;    // main() までの時間 (平均)
+    double time_to_main_min_us;
+    int time_to_main_runs;     // 計測に成功した回数 (失敗した実行は平均に含めない)
+};
+
+BOOL analyze_pe_file(const wchar_t* path, SizeReport* report);
+int run_size_report(const ProgramOptions* opts, const wchar_t* compiler_path, const wchar_t* all_source_files_str,
+                    const wchar_t* auto_flags, const wchar_t* temp_dir, const wchar_t* source_stem);
+
+// --- Startup Pipeline ---
+// --- 起動処理のパイプライン ---
+
+// ヘッダとリンクフラグの対応表 (ソースが header をインクルードしていれば flags を追加)
+struct AutoLinkRule {
+    const wchar_t* header;
+    const wchar_t* flags;
+};
+
+static const AutoLinkRule g_auto_link_rules[] = {
+    // Windows APIヘッダ
+    { L"<windows.h>",  L"-lkernel32 -luser32 -lshell32 -lgdi32 -lwinspool -lcomdlg32 -ladvapi32" },
+    { L"<winsock2.h>", L"-lws2_32" },
+    { L"<winsock.h>",  L"-lws2_32" },
+    { L"<shlobj.h>",   L"-lole32" },
+    { L"<dwmapi.h>",   L"-ldwmapi" },
+    // 標準ライブラリヘッダ
+    { L"<pthread.h>",  L"-lpthread" },
+    { L"<math.h>",     L"-lm" },
+};
+#define NUM_AUTO_LINK_RULES ((int)(sizeof(g_auto_link_rules) / sizeof(g_auto_link_rules[0])))
+
+// ソース1つ分の読み込み・ヘッダ解析の結果
+struct ScanTask {
+    const wchar_t* full_path;
+    DWORD rule_mask;           // 該当した g_auto_link_rules のビット
+    BOOL read_ok;              // FALSE なら -MM によるフォールバックが必要
+    double elapsed_ms;
+};
+
+// 解析ワーカーが共有するキュー
+struct ScanQueue {
+    ScanTask* tasks;
+    int num_tasks;
+    volatile LONG next;        // 次に処理するタスクの番号
+};
+
+// コンパイラの検索
+struct ToolchainTask {
+    const wchar_t* exe_name;
+    wchar_t path[MAX_PATH];
+    BOOL found;
+    double elapsed_ms;
+};
+
+// 一時ディレクトリの作成
+struct WorkspaceTask {
+    wchar_t temp_dir[MAX_PATH];
+    BOOL created;
+    double elapsed_ms;
+};
+
+HANDLE start_worker(LPTHREAD_START_ROUTINE proc, LPVOID param);
+void join_workers(HANDLE* workers, int num_workers);
+DWORD WINAPI scan_worker(LPVOID param);
+DWORD WINAPI toolchain_worker(LPVOID param);
+DWORD WINAPI workspace_worker(LPVOID param);
+void append_auto_link_flags(const ScanTask* tasks, int num_tasks, const wchar_t* compiler_path,
+                            wchar_t* lib_flags, size_t lib_flags_size);
+wchar_t* build_source_list(const wchar_t (*source_full_paths)[MAX_PATH], int num_sources);
+void split_user_flags(const wchar_t* flags, wchar_t* compile_flags, wchar_t* link_flags, size_t flags_size);
+void remove_flag_token(wchar_t* flags, const wchar_t* token);
+BOOL contains_flag_token(const wchar_t* flags, const wchar_t* token);
+void get_object_path(const wchar_t* temp_dir, const wchar_t* source_path, int index, wchar_t* object_path, size_t object_path_size);
+BOOL write_object_response_file(const wchar_t* response_path, const wchar_t* temp_dir, const wchar_t (*source_full_paths)[MAX_PATH], int num_sources);
+double elapsed_ms_between(const LARGE_INTEGER* start, const LARGE_INTEGER* end);
+
+// --- Symbol Index ---
+// --- シンボル索引 (未定義シンボルからライブラリを自動解決) ---
+#define SYMBOL_INDEX_HEADER "crun-symbol-index 2"
+#define MAX_UNDEFINED_SYMBOLS 64
+#define RESOLVED_LIBS_SIZE 512     // 解決したライブラリの一覧と、プロファイルの libs の最大長
+// リンクフラグ: ヘッダからの自動フラグ (表の合計は200文字未満) + プロファイルの libs + 今回解決したライブラリ
+#define LIB_FLAGS_SIZE (1024 + RESOLVED_LIBS_SIZE * 2)
+
+// ライブラリ1つ分の索引 (インポートライブラリ・静的ライブラリのシンボル表)
+struct LibraryEntry {
+    wchar_t path[MAX_PATH];
+    char lname[64];            // -l に渡す名前 (libfoo.a / libfoo.dll.a / foo.lib -> "foo")
+    ULONGLONG size;            // 変更検出用のファイルサイズ
+    ULONGLONG mtime;           // 変更検出用の更新日時
+    char* symbols;             // '\0' 区切りのシンボル名の並び
+    DWORD symbols_size;        // symbols のバイト数
+};
+
+// ツールチェーンのライブラリ検索パスにあるライブラリの索引
+struct SymbolIndex {
+    LibraryEntry* libs;
+    int num_libs;
+    int capacity;
+    BOOL dirty;                // キャッシュの書き直しが必要か
+};
+
+// 未定義シンボル1つと、それを解決するために追加したライブラリ
+struct ResolvedSymbol {
+    char symbol[256];
+    wchar_t flag[72];          // "-lfoo"
+};
+
+BOOL has_undefined_symbols(const wchar_t* link_output);
+BOOL update_symbol_index(const wchar_t* compiler_path, SymbolIndex* index, BOOL verbose);
+int resolve_undefined_symbols(const wchar_t* link_output, const SymbolIndex* index, const wchar_t* lib_flags,
+                              ResolvedSymbol* resolved, int* num_resolved, wchar_t* resolved_libs, size_t resolved_libs_size);
+void get_effective_libraries(const ResolvedSymbol* resolved, int num_resolved, const wchar_t* relink_output,
+                             wchar_t* effective_libs, size_t effective_libs_size);
+void free_symbol_index(SymbolIndex* index);
+
 // --- Help and Version ---
 // --- ヘルプとバージョン情報を表示する関数 ---
 void print_help() {
@@ -72,6 +272,7 @@ void print_help() {
         L"crun - A simple C/C++ runner.\n\n"
         L"USAGE:\n"
         L"    crun <source_file> [program_arguments...] [options...]\n"
+        L"    crun --tune <source_file> [-- program_arguments...]\n"
         L"    crun --clean\n\n"
         L"OPTIONS:\n"
         L"    --help              Show this help message.\n"
@@ -83,6 +284,14 @@ void print_help() {
         L"    --time              Measure and show the execution time.\n"
         L"    --wall              Enable all compiler warnings (-Wall).\n"
         L"    --debug, -g         Enable debug build (-g).\n"
+        L"    --tune              Build with a matrix of compilers/flags, benchmark each binary\n"
+        L"                        and save the fastest configuration as the default for the source.\n"
+        L"    --tune-config <file> Read the tuning matrix from <file> (default: crun_tune.ini next to the source).\n"
+        L"    --size-report       Report section sizes, the largest symbols and the time to main()\n"
+        L"                        of the built executable instead of running it.\n"
+        L"    --size-report-static Also build with -static and compare against the default linking.\n"
+        L"    --size-report-json <file> Write the size report to <file> as JSON.\n"
+        L"    --                  Treat all remaining arguments as program arguments.\n"
         L"    --clean             Remove temporary directories (crun_tmp_*) from the current directory.\n"
     );
 }
@@ -133,15 +342,22 @@ int main() {
 
     BOOL cflags_next = FALSE;
     BOOL compiler_next = FALSE;
+    BOOL tune_config_next = FALSE;
+    BOOL size_json_next = FALSE;
+    BOOL args_only = FALSE; // "--" 以降はすべてプログラム引数
     BOOL sources_ended = FALSE; // ソースファイルのリストが終了したかを示すフラグ
 
     for (int i = 1; i < argc; ++i) {
         wchar_t* arg = argv[i];
 
+        if (args_only) { opts.program_args[opts.num_program_args++] = arg; continue; }
         if (cflags_next) { opts.compiler_flags = arg; cflags_next = FALSE; continue; }
+        if (tune_config_next) { opts.tune_config = arg; tune_config_next = FALSE; continue; }
+        if (size_json_next) { opts.size_report_json = arg; size_json_next = FALSE; continue; }
         if (compiler_next) {
             if (wcscmp(arg, L"gcc") == 0 || wcscmp(arg, L"clang") == 0) {
                 opts.compiler_name = arg;
+                opts.compiler_explicit = TRUE;
             } else {
                 fwprintf_err(L"Error: Invalid compiler. Use 'gcc' or 'clang'.\n");
                 free(opts.source_files); free(opts.program_args);
@@ -162,6 +378,12 @@ int main() {
         if (wcscmp(arg, L"--clean") == 0) { continue; } // Special handling at the start
         if (wcscmp(arg, L"--cflags") == 0) { cflags_next = TRUE; continue; }
         if (wcscmp(arg, L"--compiler") == 0) { compiler_next = TRUE; continue; }
+        if (wcscmp(arg, L"--tune") == 0) { opts.tune = TRUE; continue; }
+        if (wcscmp(arg, L"--tune-config") == 0) { tune_config_next = TRUE; continue; }
+        if (wcscmp(arg, L"--size-report") == 0) { opts.size_report = TRUE; continue; }
+        if (wcscmp(arg, L"--size-report-static") == 0) { opts.size_report = TRUE; opts.size_report_static = TRUE; continue; }
+        if (wcscmp(arg, L"--size-report-json") == 0) { opts.size_report = TRUE; size_json_next = TRUE; continue; }
+        if (wcscmp(arg, L"--") == 0) { args_only = TRUE; sources_ended = TRUE; continue; }
 
         // オプションかどうかを判定
         if (wcsncmp(arg, L"--", 2) == 0) {
@@ -182,7 +404,7 @@ int main() {
         }
     }
 
-    if (cflags_next || compiler_next) { fwprintf_err(L"Error: Option requires an argument.\n"); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1; }
+    if (cflags_next || compiler_next || tune_config_next || size_json_next) { fwprintf_err(L"Error: Option requires an argument.\n"); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1; }
     if (opts.num_source_files == 0) { fwprintf_err(L"Error: No source files specified.\n"); print_help(); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1; }
 
     // --- Path and File Setup ---
@@ -196,39 +418,102 @@ int main() {
     }
 
     BOOL has_cpp = FALSE;
-    wchar_t all_source_files_str[32767];
-    all_source_files_str[0] = L'\0';
+    wchar_t (*source_full_paths)[MAX_PATH] = (wchar_t (*)[MAX_PATH])malloc(sizeof(wchar_t[MAX_PATH]) * opts.num_source_files);
+    ScanTask* scan_tasks = (ScanTask*)calloc(opts.num_source_files, sizeof(ScanTask));
+    if (!source_full_paths || !scan_tasks) {
+        fwprintf_err(L"Error: Failed to allocate memory for source files.\n");
+        free(source_full_paths); free(scan_tasks); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
+    }
 
     for (int i = 0; i < opts.num_source_files; ++i) {
-        wchar_t full_path[MAX_PATH];
+        wchar_t* full_path = source_full_paths[i];
         if (!GetFullPathNameW(opts.source_files[i], MAX_PATH, full_path, NULL)) {
             fwprintf_err(L"Error: Could not get full path for source file: %s\n", opts.source_files[i]);
-            free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
+            free(source_full_paths); free(scan_tasks); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
         }
         if (!file_exists(full_path)) {
             fwprintf_err(L"Error: Source file not found: %s\n", full_path);
-            free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
+            free(source_full_paths); free(scan_tasks); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
         }
         const wchar_t* ext = get_extension(full_path);
         if (!ext || (wcscmp(ext, L".c") != 0 && wcscmp(ext, L".cpp") != 0)) {
             fwprintf_err(L"Error: Unsupported file type: %s. Only .c and .cpp are supported.\n", opts.source_files[i]);
-            free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
+            free(source_full_paths); free(scan_tasks); free(opts.source_files); free(opts.program_args); LocalFree(argv); return 1;
         }
         if (wcscmp(ext, L".cpp") == 0) has_cpp = TRUE;
-
-        // Add to the string for the compile command
-        wcscat_s(all_source_files_str, 32767, L" \"");
-        wcscat_s(all_source_files_str, 32767, full_path);
-        wcscat_s(all_source_files_str, 32767, L"\"");
+        scan_tasks[i].full_path = full_path;
     }
 
-    // 一時ディレクトリを作成
     wchar_t source_dir[MAX_PATH];
     get_parent_path(main_source_full_path, source_dir, MAX_PATH);
-    wchar_t temp_dir[MAX_PATH];
-    swprintf_s(temp_dir, MAX_PATH, L"%s\\crun_tmp_%lu_%lu", source_dir, GetTickCount(), GetCurrentProcessId());
-    if (!CreateDirectoryW(temp_dir, NULL)) {
+
+    // --- Saved Profile ---
+    // --- 保存済みプロファイル (--tune の結果と自動解決したライブラリ) ---
+    // ソースと同じディレクトリの crun_profile.ini に、ソースファイル名ごとのセクションで保存される
+    wchar_t profile_path[MAX_PATH];
+    swprintf_s(profile_path, MAX_PATH, L"%s\\crun_profile.ini", source_dir);
+    const wchar_t* profile_section = get_filename(main_source_full_path);
+    wchar_t profile_compiler[16] = L"";
+    wchar_t profile_cflags[128] = L"";
+    wchar_t profile_libs[RESOLVED_LIBS_SIZE] = L"";
+    if (file_exists(profile_path)) {
+        // 以前のリンクで未定義シンボルから解決したライブラリ (ビルドの種類に関係なく使う)
+        GetPrivateProfileStringW(profile_section, L"libs", L"", profile_libs, RESOLVED_LIBS_SIZE, profile_path);
+        if (opts.verbose && profile_libs[0] != L'\0') wprintf(L"Using resolved libraries from %s: %s\n", profile_path, profile_libs);
+    }
+    if (!opts.tune && !opts.debug_build && file_exists(profile_path)) {
+        GetPrivateProfileStringW(profile_section, L"compiler", L"", profile_compiler, 16, profile_path);
+        GetPrivateProfileStringW(profile_section, L"cflags", L"", profile_cflags, 128, profile_path);
+        // --compiler が明示されていればそちらを優先
+        if (!opts.compiler_explicit && (wcscmp(profile_compiler, L"gcc") == 0 || wcscmp(profile_compiler, L"clang") == 0)) {
+            opts.compiler_name = profile_compiler;
+        }
+        if (opts.verbose && profile_cflags[0] != L'\0') wprintf(L"Using tuned flags from %s: %s\n", profile_path, profile_cflags);
+    }
+
+    // --- Compiler Setup ---
+    // --- コンパイラの設定 ---
+    wchar_t compiler_exe_name[20];
+    // 拡張子に応じてコンパイラ実行ファイル名を決定 (一つでも.cppがあればC++コンパイラ)
+    get_compiler_exe_name(opts.compiler_name, has_cpp, compiler_exe_name, 20);
+
+    // --- Pipelined Setup ---
+    // --- 並行セットアップ ---
+    // コンパイラの検索、一時ディレクトリの作成、ソースの読み込みとヘッダ解析を同時に開始する。
+    // ヘッダ解析はリンクフラグにしか影響しないため、コンパイルはその完了を待たずに始める。
+    LARGE_INTEGER pipeline_start;
+    QueryPerformanceCounter(&pipeline_start);
+
+    ToolchainTask toolchain = {0};
+    toolchain.exe_name = compiler_exe_name;
+    HANDLE h_toolchain = start_worker(toolchain_worker, &toolchain);
+
+    WorkspaceTask workspace = {0};
+    swprintf_s(workspace.temp_dir, MAX_PATH, L"%s\\crun_tmp_%lu_%lu", source_dir, GetTickCount(), GetCurrentProcessId());
+    HANDLE h_workspace = start_worker(workspace_worker, &workspace);
+
+    ScanQueue scan_queue = { scan_tasks, opts.num_source_files, 0 };
+    HANDLE scan_workers[MAXIMUM_WAIT_OBJECTS];
+    int num_scan_workers = get_cpu_count();
+    if (num_scan_workers > opts.num_source_files) num_scan_workers = opts.num_source_files;
+    if (num_scan_workers > MAXIMUM_WAIT_OBJECTS) num_scan_workers = MAXIMUM_WAIT_OBJECTS;
+    for (int i = 0; i < num_scan_workers; ++i) scan_workers[i] = start_worker(scan_worker, &scan_queue);
+
+    // メインスレッドが並行処理の完了を待った時間 (--verbose で、重なった時間を求めるのに使う)
+    double setup_wait_ms = 0.0;
+    LARGE_INTEGER wait_start, wait_end;
+    QueryPerformanceCounter(&wait_start);
+    join_workers(&h_toolchain, 1);
+    join_workers(&h_workspace, 1);
+    QueryPerformanceCounter(&wait_end);
+    setup_wait_ms += elapsed_ms_between(&wait_start, &wait_end);
+
+    // 一時ディレクトリを作成
+    const wchar_t* temp_dir = workspace.temp_dir;
+    if (!workspace.created) {
         fwprintf_err(L"Error: Failed to create temporary directory.\n");
+        join_workers(scan_workers, num_scan_workers);
+        free(source_full_paths); free(scan_tasks);
         free(opts.program_args);
         LocalFree(argv);
         return 1;
@@ -238,104 +523,289 @@ int main() {
     wcsncpy_s(g_temp_dir_to_clean, MAX_PATH, temp_dir, _TRUNCATE);
     g_keep_temp = opts.keep_temp;
 
+    // PATH環境変数からコンパイラのフルパスを検索
+    // --tune は設定ファイルのコンパイラを自分で探し、見つからないものは飛ばすので、ここでは確認しない
+    const wchar_t* compiler_path = toolchain.path;
+    if (!toolchain.found && !opts.tune) {
+        fwprintf_err(L"Error: Compiler '%s' not found in PATH.\n" L"Please make sure MinGW (for gcc/g++) or Clang is installed and its 'bin' directory is in the system's PATH environment variable.\n", compiler_exe_name);
+        join_workers(scan_workers, num_scan_workers);
+        if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+        free(source_full_paths); free(scan_tasks);
+        free(opts.program_args);
+        LocalFree(argv);
+        return 1;
+    }
+
     // 実行ファイルパスを生成
     wchar_t source_stem[MAX_PATH];
     get_stem(main_source_full_path, source_stem, MAX_PATH);
     wchar_t executable_path[MAX_PATH];
     swprintf_s(executable_path, MAX_PATH, L"%s\\%s.exe", temp_dir, source_stem);
 
-    // --- Compiler Setup ---
-    // --- コンパイラの設定 ---
-    wchar_t compiler_exe_name[20];
-    // 拡張子に応じてコンパイラ実行ファイル名を決定 (一つでも.cppがあればC++コンパイラ)
-    if (has_cpp) {
-        wcscpy_s(compiler_exe_name, 20, (wcscmp(opts.compiler_name, L"gcc") == 0) ? L"g++.exe" : L"clang++.exe");
+    // プログラム引数をコマンドライン用の文字列にまとめる
+    wchar_t program_args_str[32767];
+    program_args_str[0] = L'\0';
+    for (int i = 0; i < opts.num_program_args; ++i) {
+        wcscat_s(program_args_str, 32767, L" \"");
+        wcscat_s(program_args_str, 32767, opts.program_args[i]);
+        wcscat_s(program_args_str, 32767, L"\"");
+    }
+
+    // ビルドの種類に応じてフラグを設定
+    wchar_t opt_flags[128];
+    if (opts.debug_build) {
+        wcscpy_s(opt_flags, 128, L"-g"); // デバッグ情報
+    } else if (profile_cflags[0] != L'\0') {
+        wcscpy_s(opt_flags, 128, profile_cflags); // --tune で選ばれたフラグ
     } else {
-        wcscpy_s(compiler_exe_name, 20, (wcscmp(opts.compiler_name, L"gcc") == 0) ? L"gcc.exe" : L"clang.exe");
+        wcscpy_s(opt_flags, 128, L"-O2 -s"); // リリースビルド用の最適化
+    }
+    wchar_t lib_flags[LIB_FLAGS_SIZE] = L""; // ヘッダから自動検出したリンクフラグ
+    if (profile_libs[0] != L'\0') {
+        wcscat_s(lib_flags, LIB_FLAGS_SIZE, L" ");
+        wcscat_s(lib_flags, LIB_FLAGS_SIZE, profile_libs);
     }
 
-    // PATH環境変数からコンパイラのフルパスを検索
-    wchar_t compiler_path[MAX_PATH];
-    if (!find_executable_in_path(compiler_exe_name, compiler_path, MAX_PATH)) {
-        fwprintf_err(L"Error: Compiler '%s' not found in PATH.\n" L"Please make sure MinGW (for gcc/g++) or Clang is installed and its 'bin' directory is in the system's PATH environment variable.\n", compiler_exe_name);
+    // --tune と --size-report はソース全体を1コマンドでビルドするため、解析の完了を待つ
+    if (opts.tune || opts.size_report) {
+        join_workers(scan_workers, num_scan_workers);
+        append_auto_link_flags(scan_tasks, opts.num_source_files, compiler_path, lib_flags, LIB_FLAGS_SIZE);
+        // ソースの一覧はコマンドラインに直接並べるので、上限に収まるか確認する
+        wchar_t* all_source_files_str = build_source_list(source_full_paths, opts.num_source_files);
+        if (!all_source_files_str || wcslen(all_source_files_str) > 32767 - 4096) {
+            fwprintf_err(all_source_files_str ? L"Error: Too many source files for %s (command line too long).\n" : L"Error: Failed to allocate memory for source files.\n",
+                opts.tune ? L"--tune" : L"--size-report");
+            if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+            free(all_source_files_str); free(source_full_paths); free(scan_tasks);
+            free(opts.program_args);
+            LocalFree(argv);
+            return 1;
+        }
+
+        int mode_result;
+        if (opts.tune) {
+            // --- Tuning ---
+            // --- 自動チューニング ---
+            mode_result = run_tune(&opts, has_cpp, all_source_files_str, lib_flags, temp_dir, program_args_str, profile_path, profile_section);
+        } else {
+            // --- Size Report ---
+            // --- サイズ・起動コストのレポート ---
+            wchar_t auto_flags[128 + LIB_FLAGS_SIZE]; // 自動フラグ (opt_flags + lib_flags + -Wall)
+            swprintf_s(auto_flags, 128 + LIB_FLAGS_SIZE, L"%s%s%s", opt_flags, lib_flags, opts.warnings_all ? L" -Wall" : L"");
+            mode_result = run_size_report(&opts, compiler_path, all_source_files_str, auto_flags, temp_dir, source_stem);
+        }
         if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+        free(all_source_files_str); free(source_full_paths); free(scan_tasks);
         free(opts.program_args);
         LocalFree(argv);
-        return 1;
+        return mode_result;
     }
 
     // --- Compilation ---
     // --- コンパイル ---
-    wchar_t compile_command[32767] = {0};
-    wchar_t auto_flags[256] = L""; // 自動フラグ
-
-    // ビルドの種類に応じてフラグを設定
-    if (opts.debug_build) {
-        wcscpy_s(auto_flags, 256, L"-g"); // デバッグ情報
-    } else {
-        wcscpy_s(auto_flags, 256, L"-O2 -s"); // リリースビルド用の最適化
+    // ソースが1つの場合は、従来どおりコンパイルとリンクを1つのコンパイラプロセスで行う
+    // (ヘッダ解析はコンパイラの検索・一時ディレクトリの作成と並行して終わっている)。
+    // 複数の場合は各ソースをオブジェクトファイルに並列コンパイルし、ヘッダ解析の完了を待たずに始める。
+    BOOL single_build = (opts.num_source_files == 1);
+    size_t user_flags_size = (opts.compiler_flags ? wcslen(opts.compiler_flags) : 0) + 1;
+    wchar_t* user_compile_flags = (wchar_t*)malloc(user_flags_size * sizeof(wchar_t));
+    wchar_t* user_link_flags = (wchar_t*)malloc(user_flags_size * sizeof(wchar_t));
+    wchar_t* link_inputs = single_build ? build_source_list(source_full_paths, 1) : (wchar_t*)malloc(32767 * sizeof(wchar_t));
+    wchar_t* command = (wchar_t*)malloc(32767 * sizeof(wchar_t));
+    if (!user_compile_flags || !user_link_flags || !link_inputs || !command) {
+        fwprintf_err(L"Error: Failed to allocate memory for the compile commands.\n");
+        join_workers(scan_workers, num_scan_workers);
+        if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+        free(user_compile_flags); free(user_link_flags); free(link_inputs); free(command);
+        free(source_full_paths); free(scan_tasks);
+        free(opts.program_args);
+        LocalFree(argv);
+        return 1;
     }
+    split_user_flags(opts.compiler_flags, user_compile_flags, user_link_flags, user_flags_size);
+
+    double compile_ms = 0.0; // 並列コンパイル全体の経過時間
+    if (!single_build) {
+        wchar_t compile_opt_flags[128];
+        wcscpy_s(compile_opt_flags, 128, opt_flags);
+        remove_flag_token(compile_opt_flags, L"-s"); // -s などのリンク専用フラグはリンク時のみ
+        wchar_t** compile_commands = (wchar_t**)calloc(opts.num_source_files, sizeof(wchar_t*));
+        wchar_t** compile_outputs = (wchar_t**)calloc(opts.num_source_files, sizeof(wchar_t*));
+        if (!compile_commands || !compile_outputs) {
+            fwprintf_err(L"Error: Failed to allocate memory for the compile commands.\n");
+            join_workers(scan_workers, num_scan_workers);
+            if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+            free(compile_commands); free(compile_outputs);
+            free(user_compile_flags); free(user_link_flags); free(link_inputs); free(command);
+            free(source_full_paths); free(scan_tasks);
+            free(opts.program_args);
+            LocalFree(argv);
+            return 1;
+        }
+        link_inputs[0] = L'\0';
+        BOOL objects_fit = TRUE;
+        for (int i = 0; i < opts.num_source_files; ++i) {
+            wchar_t object_path[MAX_PATH];
+            get_object_path(temp_dir, source_full_paths[i], i, object_path, MAX_PATH);
+            swprintf_s(command, 32767, L"\"%s\" -c \"%s\" -o \"%s\" %s%s %s",
+                compiler_path, source_full_paths[i], object_path, compile_opt_flags,
+                opts.warnings_all ? L" -Wall" : L"", user_compile_flags);
+            compile_commands[i] = _wcsdup(command);
+            // コンパイラの出力 (エラーや警告) はオブジェクトファイルの隣に受け、終了後に表示する
+            swprintf_s(command, 32767, L"%s.log", object_path);
+            compile_outputs[i] = _wcsdup(command);
+            // 長すぎる場合は後でレスポンスファイルに切り替える
+            if (objects_fit && wcslen(link_inputs) + wcslen(object_path) + 3 < 24000) {
+                wcscat_s(link_inputs, 32767, L" \"");
+                wcscat_s(link_inputs, 32767, object_path);
+                wcscat_s(link_inputs, 32767, L"\"");
+            } else {
+                objects_fit = FALSE;
+            }
+        }
 
-    // ソースコードの内容を読み込む
-    for (int i = 0; i < opts.num_source_files; ++i) {
-        wchar_t full_path[MAX_PATH];
-        GetFullPathNameW(opts.source_files[i], MAX_PATH, full_path, NULL);
-        wchar_t* source_content = NULL;
-        if (read_file_content_wide(full_path, &source_content)) {
-            // Windows APIヘッダのインクルードをチェック
-            if (wcsstr(source_content, L"<windows.h>")) { wcscat_s(auto_flags, 256, L" -lkernel32 -luser32 -lshell32 -lgdi32 -lwinspool -lcomdlg32 -ladvapi32"); }
-            if (wcsstr(source_content, L"<winsock2.h>") || wcsstr(source_content, L"<winsock.h>")) { wcscat_s(auto_flags, 256, L" -lws2_32"); }
-            if (wcsstr(source_content, L"<shlobj.h>")) { wcscat_s(auto_flags, 256, L" -lole32"); }
-            if (wcsstr(source_content, L"<dwmapi.h>")) { wcscat_s(auto_flags, 256, L" -ldwmapi"); }
-
-            // 標準ライブラリヘッダのインクルードをチェック
-            if (wcsstr(source_content, L"<pthread.h>")) { wcscat_s(auto_flags, 256, L" -lpthread"); }
-            if (wcsstr(source_content, L"<math.h>")) { wcscat_s(auto_flags, 256, L" -lm"); }
-
-            free(source_content); // メモリを解放
-        } else {
-            // ファイルが読み込めない場合、従来のヘッダ依存性チェックにフォールバック
-            wchar_t dep_command[MAX_PATH * 2];
-            swprintf_s(dep_command, MAX_PATH * 2, L"\"%s\" -MM %s", compiler_path, all_source_files_str);
-            wchar_t* dep_output = NULL;
-            if (run_process_and_capture_output(dep_command, &dep_output) && dep_output) {
-                if (wcsstr(dep_output, L"pthread.h")) { wcscat_s(auto_flags, 256, L" -lpthread"); }
-                if (wcsstr(dep_output, L"math.h")) { wcscat_s(auto_flags, 256, L" -lm"); }
-                free(dep_output);
+        if (opts.verbose) {
+            wprintf(L"--- Compiling ---\n");
+            for (int i = 0; i < opts.num_source_files; ++i) wprintf(L"Command: %s\n", compile_commands[i]);
+        }
+        LARGE_INTEGER compile_start, compile_end;
+        QueryPerformanceCounter(&compile_start);
+        int num_compiled = run_commands_parallel(compile_commands, opts.num_source_files, 0, opts.verbose, NULL, compile_outputs);
+        QueryPerformanceCounter(&compile_end);
+        compile_ms = elapsed_ms_between(&compile_start, &compile_end);
+        // 失敗したソースのエラーも成功したソースの警告も、ソースの順に表示する
+        for (int i = 0; i < opts.num_source_files; ++i) {
+            if (compile_outputs[i]) print_output_file(compile_outputs[i]);
+            free(compile_commands[i]);
+            free(compile_outputs[i]);
+        }
+        free(compile_commands); free(compile_outputs);
+
+        // ヘッダ解析はコンパイル中に完了しているはず
+        QueryPerformanceCounter(&wait_start);
+        join_workers(scan_workers, num_scan_workers);
+        QueryPerformanceCounter(&wait_end);
+        setup_wait_ms += elapsed_ms_between(&wait_start, &wait_end);
+
+        if (num_compiled != opts.num_source_files) {
+            fwprintf_err(L"Compilation failed.\n");
+            if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+            free(user_compile_flags); free(user_link_flags); free(link_inputs); free(command);
+            free(source_full_paths); free(scan_tasks);
+            free(opts.program_args);
+            LocalFree(argv);
+            return 1;
+        }
+        if (!objects_fit) {
+            // オブジェクトが多すぎてコマンドラインに収まらない場合はレスポンスファイル経由で渡す
+            wchar_t response_path[MAX_PATH];
+            swprintf_s(response_path, MAX_PATH, L"%s\\objects.rsp", temp_dir);
+            if (!write_object_response_file(response_path, temp_dir, source_full_paths, opts.num_source_files)) {
+                fwprintf_err(L"Error: Failed to write the linker response file.\n");
+                if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+                free(user_compile_flags); free(user_link_flags); free(link_inputs); free(command);
+                free(source_full_paths); free(scan_tasks);
+                free(opts.program_args);
+                LocalFree(argv);
+                return 1;
             }
+            swprintf_s(link_inputs, 32767, L" \"@%s\"", response_path);
         }
+    } else {
+        QueryPerformanceCounter(&wait_start);
+        join_workers(scan_workers, num_scan_workers);
+        QueryPerformanceCounter(&wait_end);
+        setup_wait_ms += elapsed_ms_between(&wait_start, &wait_end);
     }
 
-    // 警告フラグを追加
-    if (opts.warnings_all) {
-        wcscat_s(auto_flags, 256, L" -Wall");
+    // --- Linking ---
+    // --- リンク (ソースが1つの場合はコンパイルを含む) ---
+    append_auto_link_flags(scan_tasks, opts.num_source_files, compiler_path, lib_flags, LIB_FLAGS_SIZE);
+    const wchar_t* link_warning_flags = (single_build && opts.warnings_all) ? L" -Wall" : L"";
+    const wchar_t* link_user_flags = single_build ? (opts.compiler_flags ? opts.compiler_flags : L"") : user_link_flags;
+    // C++ の未定義シンボルを索引 (アーカイブのシンボル表はマングル名) と照合できるよう、リンカにはマングル名のまま報告させる
+    const wchar_t* link_symbol_flags = has_cpp ? L" -Wl,--no-demangle" : L"";
+    swprintf_s(command, 32767, L"\"%s\"%s -o \"%s\" %s%s%s%s %s",
+        compiler_path, link_inputs, executable_path, opt_flags, lib_flags, link_warning_flags, link_symbol_flags, link_user_flags);
+
+    if (opts.verbose) wprintf(single_build ? L"--- Compiling ---\nCommand: %s\n" : L"--- Linking ---\nCommand: %s\n", command);
+    LARGE_INTEGER link_start, link_end;
+    QueryPerformanceCounter(&link_start);
+    // 未定義シンボルを調べるため、リンカの出力は取り込んでから表示する
+    wchar_t* link_output = NULL;
+    BOOL linked = run_process_and_capture_output(command, &link_output);
+
+    if (!linked && link_output && has_undefined_symbols(link_output)) {
+        // 未定義シンボルを索引から引き、見つかったライブラリを追加して一度だけ再リンクする
+        // (複数ソースの場合はオブジェクトファイルを再利用するので再コンパイルはしない)
+        SymbolIndex symbol_index = {0};
+        ResolvedSymbol resolved[MAX_UNDEFINED_SYMBOLS];
+        int num_resolved = 0;
+        wchar_t resolved_libs[RESOLVED_LIBS_SIZE] = L"";
+        if (update_symbol_index(compiler_path, &symbol_index, opts.verbose) &&
+            resolve_undefined_symbols(link_output, &symbol_index, lib_flags, resolved, &num_resolved, resolved_libs, RESOLVED_LIBS_SIZE) > 0) {
+            wcscat_s(lib_flags, LIB_FLAGS_SIZE, resolved_libs);
+            swprintf_s(command, 32767, L"\"%s\"%s -o \"%s\" %s%s%s%s %s",
+                compiler_path, link_inputs, executable_path, opt_flags, lib_flags, link_warning_flags, link_symbol_flags, link_user_flags);
+            if (opts.verbose) wprintf(L"--- Relinking with%s ---\nCommand: %s\n", resolved_libs, command);
+            free(link_output);
+            link_output = NULL;
+            linked = run_process_and_capture_output(command, &link_output);
+
+            // 次回から最初のリンクで使うよう、実際に未定義シンボルを減らしたライブラリだけをプロファイルに記録する
+            wchar_t effective_libs[RESOLVED_LIBS_SIZE] = L"";
+            if (link_output) get_effective_libraries(resolved, num_resolved, link_output, effective_libs, RESOLVED_LIBS_SIZE);
+            if (effective_libs[0] != L'\0') {
+                if (wcslen(profile_libs) + wcslen(effective_libs) < RESOLVED_LIBS_SIZE) {
+                    wchar_t saved_libs[RESOLVED_LIBS_SIZE];
+                    swprintf_s(saved_libs, RESOLVED_LIBS_SIZE, L"%s%s", profile_libs, profile_libs[0] ? effective_libs : effective_libs + 1);
+                    WritePrivateProfileStringW(profile_section, L"libs", saved_libs, profile_path);
+                    if (opts.verbose) wprintf(L"Saved resolved libraries for %s to %s:%s\n", profile_section, profile_path, effective_libs);
+                } else if (opts.verbose) {
+                    wprintf(L"Not saving resolved libraries for %s: the libs entry in %s would be too long.\n", profile_section, profile_path);
+                }
+            }
+        }
+        free_symbol_index(&symbol_index);
     }
-
-    // 最終的なコンパイルコマンドを構築
-    swprintf_s(compile_command, 32767, L"\"%s\" %s -o \"%s\" %s %s",
-        compiler_path, all_source_files_str, executable_path, auto_flags,
-        opts.compiler_flags ? opts.compiler_flags : L"");
-
-    if (opts.verbose) wprintf(L"--- Compiling ---\nCommand: %s\n", compile_command);
-    if (!run_process(compile_command, opts.verbose)) {
-        fwprintf_err(L"Compilation failed.\n");
+    QueryPerformanceCounter(&link_end);
+    if (link_output && link_output[0] != L'\0') fwprintf_err(L"%s", link_output);
+    free(link_output);
+    free(user_compile_flags); free(user_link_flags); free(link_inputs); free(command);
+    if (!linked) {
+        fwprintf_err(single_build ? L"Compilation failed.\n" : L"Linking failed.\n");
         if (!opts.keep_temp) remove_directory_recursively(temp_dir);
+        free(source_full_paths); free(scan_tasks);
         free(opts.program_args);
         LocalFree(argv);
         return 1;
     }
-    if (opts.verbose) wprintf(L"Compilation successful.\n");
+    if (opts.verbose) {
+        wprintf(L"Compilation successful.\n");
+        // 検索・一時ディレクトリ作成・解析の所要時間のうち、メインスレッドが待たずに済んだ分を
+        // 並行化で重なった時間として表示する (コンパイルは経過時間のみ。逐次実行は計測していない)
+        double scan_ms = 0.0;
+        for (int i = 0; i < opts.num_source_files; ++i) scan_ms += scan_tasks[i].elapsed_ms;
+        double link_ms = elapsed_ms_between(&link_start, &link_end);
+        double setup_ms = toolchain.elapsed_ms + workspace.elapsed_ms + scan_ms;
+        double overlap_ms = setup_ms > setup_wait_ms ? setup_ms - setup_wait_ms : 0.0;
+        double critical_ms = elapsed_ms_between(&pipeline_start, &link_end);
+        if (single_build) {
+            wprintf(L"Pipeline: lookup %.2f ms, workspace %.2f ms, scan %.2f ms, compile+link %.2f ms\n",
+                toolchain.elapsed_ms, workspace.elapsed_ms, scan_ms, link_ms);
+        } else {
+            wprintf(L"Pipeline: lookup %.2f ms, workspace %.2f ms, scan %.2f ms (%d files), compile %.2f ms (wall), link %.2f ms\n",
+                toolchain.elapsed_ms, workspace.elapsed_ms, scan_ms, opts.num_source_files, compile_ms, link_ms);
+        }
+        wprintf(L"Critical path: %.2f ms (setup %.2f ms, waited %.2f ms, overlapped %.2f ms)\n",
+            critical_ms, setup_ms, setup_wait_ms, overlap_ms);
+    }
+    free(source_full_paths); free(scan_tasks);
 
     // --- Execution ---
     // --- 実行 ---
     wchar_t run_command[32767];
-    swprintf_s(run_command, 32767, L"\"%s\"", executable_path);
-    // プログラム引数をコマンドラインに追加
-    for (int i = 0; i < opts.num_program_args; ++i) {
-        wcscat_s(run_command, 32767, L" \"");
-        wcscat_s(run_command, 32767, opts.program_args[i]);
-        wcscat_s(run_command, 32767, L"\"");
-    }
+    swprintf_s(run_command, 32767, L"\"%s\"%s", executable_path, program_args_str);
 
     if (opts.verbose) { wprintf(L"--- Running ---\n"); fflush(stdout); }
 
@@ -380,6 +850,18 @@ BOOL file_exists(const wchar_t* path) {
 
 // プロセスを実行し、完了を待つ
 BOOL run_process(wchar_t* command_line, BOOL verbose) {
+    HANDLE h_process;
+    if (!start_process(command_line, verbose, NULL, &h_process)) return FALSE;
+    WaitForSingleObject(h_process, INFINITE);
+    DWORD exit_code;
+    GetExitCodeProcess(h_process, &exit_code);
+    CloseHandle(h_process);
+    return exit_code == 0;
+}
+
+// プロセスを起動し、待機せずにプロセスハンドルを返す
+// (h_output が NULL でなければ、標準出力と標準エラー出力をそこへ書き込ませる)
+BOOL start_process(wchar_t* command_line, BOOL verbose, HANDLE h_output, HANDLE* p_process) {
     PROCESS_INFORMATION pi = {0};
     STARTUPINFOW si = {0};
     si.cb = sizeof(STARTUPINFOW);
@@ -388,15 +870,74 @@ BOOL run_process(wchar_t* command_line, BOOL verbose) {
         si.dwFlags |= STARTF_USESHOWWINDOW;
         si.wShowWindow = SW_HIDE;
     }
-    if (!CreateProcessW(NULL, command_line, NULL, NULL, FALSE, verbose ? 0 : CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
+    if (h_output) {
+        si.dwFlags |= STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = h_output;
+        si.hStdError = h_output;
+    }
+    if (!CreateProcessW(NULL, command_line, NULL, NULL, h_output != NULL, verbose ? 0 : CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
         return FALSE;
     }
-    WaitForSingleObject(pi.hProcess, INFINITE);
-    DWORD exit_code;
-    GetExitCodeProcess(pi.hProcess, &exit_code);
-    CloseHandle(pi.hProcess);
     CloseHandle(pi.hThread);
-    return exit_code == 0;
+    *p_process = pi.hProcess;
+    return TRUE;
+}
+
+// 複数のコマンドを最大 jobs 個ずつ並列に実行し、成功した数を返す (jobs <= 0 ならCPUコア数)
+// (output_paths が NULL でなければ、各コマンドの出力をそのファイルに書き込ませる。
+//  パイプだと並列に読み続ける必要があるので、ファイルに受けて終了後に読む)
+int run_commands_parallel(wchar_t** commands, int num_commands, int jobs, BOOL verbose, BOOL* succeeded, wchar_t** output_paths) {
+    if (jobs <= 0) jobs = get_cpu_count();
+    if (jobs > MAXIMUM_WAIT_OBJECTS) jobs = MAXIMUM_WAIT_OBJECTS;
+
+    HANDLE running[MAXIMUM_WAIT_OBJECTS];
+    int running_index[MAXIMUM_WAIT_OBJECTS];
+    int num_running = 0, next = 0, num_succeeded = 0;
+    while (next < num_commands || num_running > 0) {
+        while (num_running < jobs && next < num_commands) {
+            if (succeeded) succeeded[next] = FALSE;
+            HANDLE h_process, h_output = NULL;
+            if (output_paths) {
+                SECURITY_ATTRIBUTES sa_attr = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+                h_output = CreateFileW(output_paths[next], GENERIC_WRITE, FILE_SHARE_READ, &sa_attr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (h_output == INVALID_HANDLE_VALUE) h_output = NULL;
+            }
+            BOOL started = start_process(commands[next], verbose, h_output, &h_process);
+            if (h_output) CloseHandle(h_output); // 子プロセスが複製を持っているので閉じてよい
+            if (started) {
+                running[num_running] = h_process;
+                running_index[num_running] = next;
+                num_running++;
+            }
+            next++;
+        }
+        if (num_running == 0) continue;
+
+        DWORD wait_result = WaitForMultipleObjects((DWORD)num_running, running, FALSE, INFINITE);
+        if (wait_result == WAIT_FAILED) break;
+        int slot = (int)(wait_result - WAIT_OBJECT_0);
+        DWORD exit_code = 1;
+        GetExitCodeProcess(running[slot], &exit_code);
+        CloseHandle(running[slot]);
+        if (exit_code == 0) {
+            num_succeeded++;
+            if (succeeded) succeeded[running_index[slot]] = TRUE;
+        }
+        // 終了したスロットを末尾の要素で埋める
+        num_running--;
+        running[slot] = running[num_running];
+        running_index[slot] = running_index[num_running];
+    }
+    for (int i = 0; i < num_running; ++i) CloseHandle(running[i]);
+    return num_succeeded;
+}
+
+// 論理CPUコア数を取得
+int get_cpu_count() {
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    return sys_info.dwNumberOfProcessors > 0 ? (int)sys_info.dwNumberOfProcessors : 1;
 }
 
 // プログラムを実行し、標準入出力を引き継いで終了コードを取得
@@ -469,6 +1010,27 @@ BOOL run_process_and_capture_output(wchar_t* command_line, wchar_t** output) {
     return exit_code == 0;
 }
 
+// run_commands_parallel が書き出したコマンドの出力を標準エラー出力に表示する (空なら何もしない)
+void print_output_file(const wchar_t* path) {
+    FILE* fp = _wfopen(path, L"rb");
+    if (!fp) return;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* narrow_output = (size > 0) ? (char*)malloc(size + 1) : NULL;
+    if (narrow_output) {
+        size_t bytes_read = fread(narrow_output, 1, size, fp);
+        narrow_output[bytes_read] = '\0';
+        // UTF-8からワイド文字列に変換
+        int wchars_num = MultiByteToWideChar(CP_UTF8, 0, narrow_output, -1, NULL, 0);
+        wchar_t* output = (wchar_t*)malloc(wchars_num * sizeof(wchar_t));
+        if (output && MultiByteToWideChar(CP_UTF8, 0, narrow_output, -1, output, wchars_num) > 0) fwprintf_err(L"%s", output);
+        free(output);
+        free(narrow_output);
+    }
+    fclose(fp);
+}
+
 // PATH環境変数から実行ファイルを検索
 BOOL find_executable_in_path(const wchar_t* exe_name, wchar_t* out_path, size_t out_path_size) {
     return SearchPathW(NULL, exe_name, NULL, (DWORD)out_path_size, out_path, NULL) > 0;
@@ -593,4 +1155,1545 @@ void clean_temp_directories(const wchar_t* target_dir) {
     } else {
         wprintf(L"No crun temporary directories found to clean.\n");
     }
-}
\ No newline at end of file
+}
+
+// コンパイラ名と言語からコンパイラの実行ファイル名を決定
+void get_compiler_exe_name(const wchar_t* compiler_name, BOOL has_cpp, wchar_t* out_name, size_t out_name_size) {
+    if (has_cpp) {
+        wcscpy_s(out_name, out_name_size, (wcscmp(compiler_name, L"gcc") == 0) ? L"g++.exe" : L"clang++.exe");
+    } else {
+        wcscpy_s(out_name, out_name_size, (wcscmp(compiler_name, L"gcc") == 0) ? L"gcc.exe" : L"clang.exe");
+    }
+}
+
+// パスからファイル名部分を取得
+const wchar_t* get_filename(const wchar_t* path) {
+    const wchar_t* last_slash = wcsrchr(path, L'\\');
+    return last_slash ? last_slash + 1 : path;
+}
+
+// --- Tuning Implementation ---
+// --- 自動チューニングの実装 ---
+
+// カンマ区切りのリストを分割する (空白は除去)
+static int split_tune_list(const wchar_t* list, wchar_t out[][16], int max_items) {
+    int count = 0;
+    const wchar_t* p = list;
+    while (*p && count < max_items) {
+        while (*p == L' ' || *p == L'\t' || *p == L',') p++;
+        if (!*p) break;
+        int len = 0;
+        while (p[len] && p[len] != L',') len++;
+        int trimmed = len;
+        while (trimmed > 0 && (p[trimmed - 1] == L' ' || p[trimmed - 1] == L'\t')) trimmed--;
+        if (trimmed > 0 && trimmed < 16) {
+            wcsncpy_s(out[count], 16, p, trimmed);
+            count++;
+        }
+        p += len;
+    }
+    return count;
+}
+
+// "on,off" 形式のリストを BOOL の配列に変換する
+static int parse_switch_list(const wchar_t* list, BOOL out[2]) {
+    wchar_t items[TUNE_MAX_VALUES][16];
+    int n = split_tune_list(list, items, TUNE_MAX_VALUES);
+    int count = 0;
+    BOOL seen_on = FALSE, seen_off = FALSE;
+    for (int i = 0; i < n; ++i) {
+        if (wcscmp(items[i], L"on") == 0 && !seen_on) { out[count++] = TRUE; seen_on = TRUE; }
+        else if (wcscmp(items[i], L"off") == 0 && !seen_off) { out[count++] = FALSE; seen_off = TRUE; }
+    }
+    if (count == 0) { out[0] = FALSE; count = 1; } // 不正な値の場合は無効のみ
+    return count;
+}
+
+// [tune] セクションの値を読み込む (path が NULL なら既定値)
+static void read_tune_value(const wchar_t* path, const wchar_t* key, const wchar_t* def, wchar_t value[256]) {
+    if (path) GetPrivateProfileStringW(L"tune", key, def, value, 256, path);
+    else wcscpy_s(value, 256, def);
+}
+
+// チューニング設定を読み込む。ファイルがなければ既定の組み合わせを使う。
+//
+// [tune]
+// compilers = gcc, clang
+// opt = -O2, -O3, -Os
+// march_native = on, off
+// unroll_loops = on, off
+// lto = on, off
+// runs = 5
+// jobs = 0
+void load_tune_config(const wchar_t* config_path, TuneConfig* cfg) {
+    wchar_t value[256];
+    // 設定ファイルがない場合は既定値をそのまま使う (空のパスを渡すと win.ini が参照されるため)
+    const wchar_t* path = (config_path && file_exists(config_path)) ? config_path : NULL;
+
+    read_tune_value(path, L"compilers", L"gcc,clang", value);
+    cfg->num_compilers = split_tune_list(value, cfg->compilers, TUNE_MAX_VALUES);
+    read_tune_value(path, L"opt", L"-O2,-O3,-Os", value);
+    cfg->num_opt_levels = split_tune_list(value, cfg->opt_levels, TUNE_MAX_VALUES);
+    read_tune_value(path, L"march_native", L"on,off", value);
+    cfg->num_march_native = parse_switch_list(value, cfg->march_native);
+    read_tune_value(path, L"unroll_loops", L"on,off", value);
+    cfg->num_unroll_loops = parse_switch_list(value, cfg->unroll_loops);
+    read_tune_value(path, L"lto", L"on,off", value);
+    cfg->num_lto = parse_switch_list(value, cfg->lto);
+    cfg->runs = path ? (int)GetPrivateProfileIntW(L"tune", L"runs", 5, path) : 5;
+    cfg->jobs = path ? (int)GetPrivateProfileIntW(L"tune", L"jobs", 0, path) : 0;
+
+    if (cfg->num_opt_levels == 0) { wcscpy_s(cfg->opt_levels[0], 16, L"-O2"); cfg->num_opt_levels = 1; }
+    if (cfg->runs < 2) cfg->runs = 2; // 信頼区間の計算には2回以上必要
+}
+
+// 標準入出力を NUL に向けてプログラムを実行し、経過時間を計測する
+// (起動できなかった場合と、終了コードが0以外の場合は FALSE)
+static BOOL run_program_timed(wchar_t* command_line, HANDLE h_null, double* elapsed_ms, DWORD* exit_code) {
+    PROCESS_INFORMATION pi = {0};
+    STARTUPINFOW si = {0};
+    si.cb = sizeof(STARTUPINFOW);
+    si.dwFlags |= STARTF_USESTDHANDLES;
+    si.hStdInput = h_null;
+    si.hStdOutput = h_null;
+    si.hStdError = h_null;
+
+    LARGE_INTEGER start_time, end_time, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start_time);
+    *exit_code = (DWORD)-1;
+    if (!CreateProcessW(NULL, command_line, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
+        return FALSE;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    QueryPerformanceCounter(&end_time);
+    GetExitCodeProcess(pi.hProcess, exit_code);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    *elapsed_ms = (double)(end_time.QuadPart - start_time.QuadPart) * 1000.0 / frequency.QuadPart;
+    return *exit_code == 0;
+}
+
+// 両側95%信頼区間のt値 (自由度 df)
+static double t_critical_95(int df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df < 1) return 0.0;
+    return (df <= 30) ? table[df - 1] : 1.960;
+}
+
+// 平均実行時間の昇順に並べる (ビルド失敗と実行失敗は末尾)
+static int compare_tune_candidates(const void* a, const void* b) {
+    const TuneCandidate* ca = (const TuneCandidate*)a;
+    const TuneCandidate* cb = (const TuneCandidate*)b;
+    if (ca->built != cb->built) return ca->built ? -1 : 1;
+    if (!ca->built) return 0;
+    return (ca->mean_ms < cb->mean_ms) ? -1 : (ca->mean_ms > cb->mean_ms) ? 1 : 0;
+}
+
+// 構成の組み合わせをすべて並列ビルドし、1つずつ順番に計測して最速の構成を保存する
+int run_tune(const ProgramOptions* opts, BOOL has_cpp, const wchar_t* all_source_files_str, const wchar_t* lib_flags,
+             const wchar_t* temp_dir, const wchar_t* program_args_str, const wchar_t* profile_path, const wchar_t* profile_section) {
+    // 設定ファイルの場所を決定 (--tune-config がなければソースと同じディレクトリの crun_tune.ini)
+    wchar_t config_path[MAX_PATH] = L"";
+    if (opts->tune_config) {
+        if (!GetFullPathNameW(opts->tune_config, MAX_PATH, config_path, NULL) || !file_exists(config_path)) {
+            fwprintf_err(L"Error: Tuning config not found: %s\n", opts->tune_config);
+            return 1;
+        }
+    } else {
+        get_parent_path(profile_path, config_path, MAX_PATH);
+        wcscat_s(config_path, MAX_PATH, L"\\crun_tune.ini");
+    }
+
+    TuneConfig cfg = {0};
+    load_tune_config(config_path, &cfg);
+
+    // 使用可能なコンパイラのパスを解決
+    wchar_t compiler_paths[TUNE_MAX_VALUES][MAX_PATH];
+    BOOL compiler_found[TUNE_MAX_VALUES] = {0};
+    for (int c = 0; c < cfg.num_compilers; ++c) {
+        if (wcscmp(cfg.compilers[c], L"gcc") != 0 && wcscmp(cfg.compilers[c], L"clang") != 0) {
+            fwprintf_err(L"Warning: Ignoring unknown compiler '%s' in tuning config.\n", cfg.compilers[c]);
+            continue;
+        }
+        wchar_t exe_name[20];
+        get_compiler_exe_name(cfg.compilers[c], has_cpp, exe_name, 20);
+        compiler_found[c] = find_executable_in_path(exe_name, compiler_paths[c], MAX_PATH);
+        if (!compiler_found[c]) fwprintf_err(L"Warning: Compiler '%s' not found in PATH, skipping.\n", exe_name);
+    }
+
+    // 候補の一覧を作成
+    TuneCandidate* candidates = (TuneCandidate*)calloc(TUNE_MAX_CANDIDATES, sizeof(TuneCandidate));
+    int* compiler_index = (int*)calloc(TUNE_MAX_CANDIDATES, sizeof(int));
+    if (!candidates || !compiler_index) {
+        fwprintf_err(L"Error: Failed to allocate memory for tuning.\n");
+        free(candidates); free(compiler_index);
+        return 1;
+    }
+    int num_candidates = 0;
+    for (int c = 0; c < cfg.num_compilers; ++c) {
+        if (!compiler_found[c]) continue;
+        for (int o = 0; o < cfg.num_opt_levels; ++o)
+        for (int m = 0; m < cfg.num_march_native; ++m)
+        for (int u = 0; u < cfg.num_unroll_loops; ++u)
+        for (int l = 0; l < cfg.num_lto; ++l) {
+            if (num_candidates >= TUNE_MAX_CANDIDATES) break;
+            TuneCandidate* cand = &candidates[num_candidates];
+            cand->compiler_name = cfg.compilers[c];
+            swprintf_s(cand->flags, 128, L"%s%s%s%s -s", cfg.opt_levels[o],
+                cfg.march_native[m] ? L" -march=native" : L"",
+                cfg.unroll_loops[u] ? L" -funroll-loops" : L"",
+                cfg.lto[l] ? L" -flto" : L"");
+            swprintf_s(cand->exe_path, MAX_PATH, L"%s\\tune_%03d.exe", temp_dir, num_candidates);
+            compiler_index[num_candidates] = c;
+            num_candidates++;
+        }
+    }
+    if (num_candidates == 0) {
+        fwprintf_err(L"Error: No tuning configurations to build.\n");
+        free(candidates); free(compiler_index);
+        return 1;
+    }
+
+    // --- Parallel Builds ---
+    // --- 並列ビルド ---
+    int jobs = cfg.jobs > 0 ? cfg.jobs : get_cpu_count();
+    if (jobs > MAXIMUM_WAIT_OBJECTS) jobs = MAXIMUM_WAIT_OBJECTS;
+
+    wprintf(L"--- Tuning: building %d configurations (%d parallel jobs) ---\n", num_candidates, jobs);
+    fflush(stdout);
+
+    wchar_t* command = (wchar_t*)malloc(32767 * sizeof(wchar_t));
+    wchar_t** build_commands = (wchar_t**)calloc(num_candidates, sizeof(wchar_t*));
+    BOOL* build_ok = (BOOL*)calloc(num_candidates, sizeof(BOOL));
+    if (!command || !build_commands || !build_ok) {
+        fwprintf_err(L"Error: Failed to allocate memory for tuning.\n");
+        free(command); free(build_commands); free(build_ok); free(candidates); free(compiler_index);
+        return 1;
+    }
+    for (int i = 0; i < num_candidates; ++i) {
+        TuneCandidate* cand = &candidates[i];
+        swprintf_s(command, 32767, L"\"%s\" %s -o \"%s\" %s%s%s %s",
+            compiler_paths[compiler_index[i]], all_source_files_str, cand->exe_path, cand->flags,
+            lib_flags, opts->warnings_all ? L" -Wall" : L"", opts->compiler_flags ? opts->compiler_flags : L"");
+        if (opts->verbose) wprintf(L"[%d] %s\n", i + 1, command);
+        build_commands[i] = _wcsdup(command);
+    }
+    // 並列ビルドの出力が混ざらないよう、コンパイラの出力は常に非表示にする
+    run_commands_parallel(build_commands, num_candidates, jobs, FALSE, build_ok, NULL);
+    int num_built = 0;
+    for (int i = 0; i < num_candidates; ++i) {
+        candidates[i].built = build_ok[i] && file_exists(candidates[i].exe_path);
+        if (candidates[i].built) num_built++;
+        free(build_commands[i]);
+    }
+    free(build_commands);
+    free(build_ok);
+
+    if (num_built == 0) {
+        fwprintf_err(L"Error: All tuning builds failed. Run without --tune to see compiler errors.\n");
+        free(command); free(candidates); free(compiler_index);
+        return 1;
+    }
+
+    // --- Benchmarking ---
+    // --- 計測 (ビルドの影響を受けないよう1つずつ順番に実行) ---
+    wprintf(L"--- Tuning: benchmarking %d binaries (%d runs each) ---\n", num_built, cfg.runs);
+    fflush(stdout);
+
+    SECURITY_ATTRIBUTES sa_attr = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    HANDLE h_null = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa_attr, OPEN_EXISTING, 0, NULL);
+    double* samples = (double*)malloc(sizeof(double) * cfg.runs);
+    if (h_null == INVALID_HANDLE_VALUE || !samples) {
+        fwprintf_err(L"Error: Failed to prepare benchmark runs.\n");
+        if (h_null != INVALID_HANDLE_VALUE) CloseHandle(h_null);
+        free(samples); free(command); free(candidates); free(compiler_index);
+        return 1;
+    }
+
+    for (int i = 0; i < num_candidates; ++i) {
+        TuneCandidate* cand = &candidates[i];
+        if (!cand->built) continue;
+        swprintf_s(command, 32767, L"\"%s\"%s", cand->exe_path, program_args_str);
+
+        // クラッシュや異常終了する構成が最速と判定されないよう、1回でも失敗したら候補から外す
+        double warmup_ms;
+        if (!run_program_timed(command, h_null, &warmup_ms, &cand->exit_code)) { // キャッシュを温める
+            cand->built = FALSE; cand->run_failed = TRUE; num_built--;
+            continue;
+        }
+
+        double sum = 0.0;
+        cand->min_ms = 0.0;
+        for (int r = 0; r < cfg.runs && !cand->run_failed; ++r) {
+            if (!run_program_timed(command, h_null, &samples[r], &cand->exit_code)) {
+                cand->built = FALSE; cand->run_failed = TRUE; num_built--;
+                break;
+            }
+            sum += samples[r];
+            if (r == 0 || samples[r] < cand->min_ms) cand->min_ms = samples[r];
+        }
+        if (cand->run_failed) {
+            if (opts->verbose) wprintf(L"  %-6s %-45s run failed (exit code 0x%08lX)\n", cand->compiler_name, cand->flags, cand->exit_code);
+            continue;
+        }
+        cand->mean_ms = sum / cfg.runs;
+        double sq_sum = 0.0;
+        for (int r = 0; r < cfg.runs; ++r) sq_sum += (samples[r] - cand->mean_ms) * (samples[r] - cand->mean_ms);
+        double stddev = sqrt(sq_sum / (cfg.runs - 1));
+        cand->ci_ms = t_critical_95(cfg.runs - 1) * stddev / sqrt((double)cfg.runs);
+        if (opts->verbose) wprintf(L"  %-6s %-45s %10.3f ms\n", cand->compiler_name, cand->flags, cand->mean_ms);
+    }
+    CloseHandle(h_null);
+    free(samples);
+
+    // --- Results ---
+    // --- 結果の表示 ---
+    qsort(candidates, num_candidates, sizeof(TuneCandidate), compare_tune_candidates);
+
+    wprintf(L"\n--- Tuning results (mean of %d runs, 95%% confidence interval) ---\n", cfg.runs);
+    wprintf(L"Rank  Compiler  %-45s %22s %12s\n", L"Flags", L"Mean (ms)", L"Min (ms)");
+    for (int i = 0; i < num_candidates; ++i) {
+        TuneCandidate* cand = &candidates[i];
+        if (cand->built) {
+            wprintf(L"%4d  %-8s  %-45s %11.3f +/- %7.3f %12.3f\n", i + 1, cand->compiler_name, cand->flags, cand->mean_ms, cand->ci_ms, cand->min_ms);
+        } else if (cand->run_failed) {
+            wchar_t status[32];
+            swprintf_s(status, 32, L"run failed (0x%08lX)", cand->exit_code);
+            wprintf(L"  --  %-8s  %-45s %22s\n", cand->compiler_name, cand->flags, status);
+        } else {
+            wprintf(L"  --  %-8s  %-45s %22s\n", cand->compiler_name, cand->flags, L"build failed");
+        }
+    }
+
+    if (num_built == 0) {
+        fwprintf_err(L"Error: All tuning configurations failed to run. The profile was not changed.\n");
+        free(command); free(candidates); free(compiler_index);
+        return 1;
+    }
+
+    // 最速の構成をこのソースの既定として保存
+    TuneCandidate* best = &candidates[0];
+    int result = 0;
+    if (WritePrivateProfileStringW(profile_section, L"compiler", best->compiler_name, profile_path) &&
+        WritePrivateProfileStringW(profile_section, L"cflags", best->flags, profile_path)) {
+        wprintf(L"\nSaved best configuration for %s to %s:\n    --compiler %s %s\n", profile_section, profile_path, best->compiler_name, best->flags);
+    } else {
+        fwprintf_err(L"Error: Failed to save tuning result to %s\n", profile_path);
+        result = 1;
+    }
+
+    free(command); free(candidates); free(compiler_index);
+    return result;
+}
+
+// --- Size Report Implementation ---
+// --- サイズ・起動コストのレポートの実装 ---
+
+// リトルエンディアンの値を読む
+static WORD pe_u16(const unsigned char* p) { return (WORD)(p[0] | (p[1] << 8)); }
+static DWORD pe_u32(const unsigned char* p) { return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24); }
+
+// ファイル全体をバイト列として読み込む
+static BOOL read_file_bytes(const wchar_t* path, unsigned char** data, DWORD* size) {
+    HANDLE h_file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h_file == INVALID_HANDLE_VALUE) return FALSE;
+    DWORD file_size = GetFileSize(h_file, NULL);
+    if (file_size == INVALID_FILE_SIZE) { CloseHandle(h_file); return FALSE; }
+    unsigned char* buffer = (unsigned char*)malloc(file_size + 1);
+    if (!buffer) { CloseHandle(h_file); return FALSE; }
+    DWORD bytes_read;
+    if (!ReadFile(h_file, buffer, file_size, &bytes_read, NULL) || bytes_read != file_size) {
+        free(buffer); CloseHandle(h_file); return FALSE;
+    }
+    CloseHandle(h_file);
+    *data = buffer;
+    *size = file_size;
+    return TRUE;
+}
+
+// COFF文字列表から名前を取り出す (範囲外なら空文字列)
+static void copy_coff_string(const unsigned char* strtab, DWORD strtab_size, DWORD offset, char* out, size_t out_size) {
+    out[0] = '\0';
+    if (!strtab || offset < 4 || offset >= strtab_size) return;
+    size_t i = 0;
+    while (i + 1 < out_size && offset + i < strtab_size && strtab[offset + i] != '\0') {
+        out[i] = (char)strtab[offset + i];
+        i++;
+    }
+    out[i] = '\0';
+}
+
+// RVAをファイルオフセットに変換する
+static BOOL rva_to_offset(const unsigned char* section_headers, int num_sections, DWORD rva, DWORD* offset) {
+    for (int i = 0; i < num_sections; ++i) {
+        const unsigned char* sh = section_headers + i * 40;
+        DWORD va = pe_u32(sh + 12), vsize = pe_u32(sh + 8), raw_size = pe_u32(sh + 16), raw_ptr = pe_u32(sh + 20);
+        DWORD extent = vsize > raw_size ? vsize : raw_size;
+        if (rva >= va && rva < va + extent) {
+            *offset = raw_ptr + (rva - va);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// サイズ推定用のシンボル (名前は上位のものだけ後で解決する)
+struct RawSymbol {
+    int section;               // 1始まりのセクション番号
+    DWORD value;               // セクション内オフセット
+    DWORD record;              // シンボル表内のインデックス
+    DWORD size;
+};
+
+static int compare_raw_symbols_by_address(const void* a, const void* b) {
+    const RawSymbol* sa = (const RawSymbol*)a;
+    const RawSymbol* sb = (const RawSymbol*)b;
+    if (sa->section != sb->section) return sa->section - sb->section;
+    return (sa->value < sb->value) ? -1 : (sa->value > sb->value) ? 1 : 0;
+}
+
+static int compare_raw_symbols_by_size(const void* a, const void* b) {
+    const RawSymbol* sa = (const RawSymbol*)a;
+    const RawSymbol* sb = (const RawSymbol*)b;
+    return (sa->size > sb->size) ? -1 : (sa->size < sb->size) ? 1 : 0;
+}
+
+// PEファイルを解析し、セクション・インポート・シンボルの情報を集める
+BOOL analyze_pe_file(const wchar_t* path, SizeReport* report) {
+    unsigned char* data = NULL;
+    DWORD size = 0;
+    if (!read_file_bytes(path, &data, &size)) return FALSE;
+
+    if (size < 0x40 || data[0] != 'M' || data[1] != 'Z') { free(data); return FALSE; }
+    DWORD pe_offset = pe_u32(data + 0x3C);
+    if (pe_offset > size - 24 || memcmp(data + pe_offset, "PE\0\0", 4) != 0) { free(data); return FALSE; }
+
+    const unsigned char* coff = data + pe_offset + 4;
+    int num_sections = pe_u16(coff + 2);
+    DWORD symtab_offset = pe_u32(coff + 8);
+    DWORD num_symbols = pe_u32(coff + 12);
+    WORD optional_size = pe_u16(coff + 16);
+    const unsigned char* optional = coff + 20;
+    DWORD section_table = pe_offset + 24 + optional_size;
+    if (optional_size < 64 || section_table + (DWORD)num_sections * 40 > size) { free(data); return FALSE; }
+    const unsigned char* section_headers = data + section_table;
+
+    // COFF文字列表 (シンボル表の直後)。長いセクション名とシンボル名に使われる
+    const unsigned char* strtab = NULL;
+    DWORD strtab_size = 0;
+    if (symtab_offset != 0 && num_symbols != 0 && num_symbols < size / 18 &&
+        num_symbols * 18 + 4 <= size && symtab_offset <= size - num_symbols * 18 - 4) {
+        strtab = data + symtab_offset + num_symbols * 18;
+        strtab_size = pe_u32(strtab);
+        if (strtab_size > size - (DWORD)(strtab - data)) strtab_size = size - (DWORD)(strtab - data);
+    } else {
+        num_symbols = 0;
+    }
+
+    report->file_size = size;
+    report->stripped_size = pe_u32(optional + 60); // SizeOfHeaders
+
+    // --- Sections ---
+    report->num_sections = 0;
+    for (int i = 0; i < num_sections && report->num_sections < SIZE_REPORT_MAX_SECTIONS; ++i) {
+        const unsigned char* sh = section_headers + i * 40;
+        SectionInfo* sec = &report->sections[report->num_sections++];
+        if (sh[0] == '/') {
+            // 8文字を超える名前は "/<文字列表のオフセット>" の形で格納されている
+            char offset_str[8];
+            memcpy(offset_str, sh + 1, 7);
+            offset_str[7] = '\0';
+            copy_coff_string(strtab, strtab_size, (DWORD)strtoul(offset_str, NULL, 10), sec->name, sizeof(sec->name));
+        } else {
+            memcpy(sec->name, sh, 8);
+            sec->name[8] = '\0';
+        }
+        sec->virtual_size = pe_u32(sh + 8);
+        sec->raw_size = pe_u32(sh + 16);
+        sec->is_debug = (strncmp(sec->name, ".debug", 6) == 0 || strncmp(sec->name, ".zdebug", 7) == 0);
+        DWORD raw_end = pe_u32(sh + 20) + sec->raw_size;
+        if (!sec->is_debug && sec->raw_size != 0 && raw_end > report->stripped_size) report->stripped_size = raw_end;
+    }
+
+    // --- Imports ---
+    // データディレクトリ[1] がインポート表 (PE32 は 96、PE32+ は 112 バイト目から)
+    DWORD data_dir = (pe_u16(optional) == 0x20b) ? 112 : 96;
+    report->num_imports = 0;
+    DWORD import_offset;
+    if (optional_size >= data_dir + 16 && pe_u32(optional + data_dir + 8) != 0 &&
+        rva_to_offset(section_headers, num_sections, pe_u32(optional + data_dir + 8), &import_offset)) {
+        while (import_offset + 20 <= size && report->num_imports < SIZE_REPORT_MAX_IMPORTS) {
+            DWORD name_rva = pe_u32(data + import_offset + 12);
+            if (name_rva == 0) break;
+            DWORD name_offset;
+            if (rva_to_offset(section_headers, num_sections, name_rva, &name_offset) && name_offset < size) {
+                char* out = report->imports[report->num_imports++];
+                size_t n = 0;
+                while (n + 1 < 64 && name_offset + n < size && data[name_offset + n] != '\0') { out[n] = (char)data[name_offset + n]; n++; }
+                out[n] = '\0';
+            }
+            import_offset += 20;
+        }
+    }
+
+    // --- Symbols ---
+    // 関数・変数のシンボルだけを集め、同じセクション内で次のシンボルまでの距離をサイズとみなす
+    report->num_symbols = 0;
+    report->num_top_symbols = 0;
+    RawSymbol* symbols = num_symbols ? (RawSymbol*)malloc(sizeof(RawSymbol) * num_symbols) : NULL;
+    int count = 0;
+    if (symbols) {
+        for (DWORD i = 0; i < num_symbols; ++i) {
+            const unsigned char* rec = data + symtab_offset + i * 18;
+            short section = (short)pe_u16(rec + 12);
+            BYTE storage_class = rec[16];
+            BYTE num_aux = rec[17];
+            BOOL dot_name = (pe_u32(rec) == 0) ? (strtab && pe_u32(rec + 4) < strtab_size && strtab[pe_u32(rec + 4)] == '.') : (rec[0] == '.');
+            // 2 = IMAGE_SYM_CLASS_EXTERNAL, 3 = IMAGE_SYM_CLASS_STATIC (セクション定義 ".text" などは除外)
+            if (section >= 1 && section <= num_sections && (storage_class == 2 || storage_class == 3) && !dot_name &&
+                section <= report->num_sections && !report->sections[section - 1].is_debug) {
+                symbols[count].section = section;
+                symbols[count].value = pe_u32(rec + 8);
+                symbols[count].record = i;
+                symbols[count].size = 0;
+                count++;
+            }
+            i += num_aux;
+        }
+        qsort(symbols, count, sizeof(RawSymbol), compare_raw_symbols_by_address);
+        for (int i = 0; i < count; ++i) {
+            DWORD end = report->sections[symbols[i].section - 1].virtual_size;
+            // 同じアドレスに複数の名前がある場合、サイズはそのうち1つだけに割り当てる
+            if (i + 1 < count && symbols[i + 1].section == symbols[i].section) {
+                if (symbols[i + 1].value == symbols[i].value) continue;
+                end = symbols[i + 1].value;
+            }
+            if (end > symbols[i].value) symbols[i].size = end - symbols[i].value;
+        }
+        report->num_symbols = count;
+
+        qsort(symbols, count, sizeof(RawSymbol), compare_raw_symbols_by_size);
+        for (int i = 0; i < count && report->num_top_symbols < SIZE_REPORT_TOP_SYMBOLS; ++i) {
+            if (symbols[i].size == 0) break;
+            SymbolInfo* sym = &report->top_symbols[report->num_top_symbols++];
+            const unsigned char* rec = data + symtab_offset + symbols[i].record * 18;
+            if (pe_u32(rec) == 0) {
+                copy_coff_string(strtab, strtab_size, pe_u32(rec + 4), sym->name, sizeof(sym->name));
+            } else {
+                memcpy(sym->name, rec, 8);
+                sym->name[8] = '\0';
+            }
+            strncpy(sym->section, report->sections[symbols[i].section - 1].name, sizeof(sym->section) - 1);
+            sym->section[sizeof(sym->section) - 1] = '\0';
+            sym->size = symbols[i].size;
+        }
+        free(symbols);
+    }
+
+    free(data);
+    return TRUE;
+}
+
+// main() の代わりに呼ばれ、プロセス生成から main() までの時間を出力するスタブ (-Wl,--wrap=main でリンク)
+// 親が CreateProcessW の直前に読んだ QueryPerformanceCounter の値を argv[1] で受け取り、その差を出力する
+// (プロセスの CreateTime はシステムのクロック刻み (既定で約15.6ms) 単位でしか更新されないため使わない)
+static const char g_startup_probe_source[] =
+    "/* crun startup probe: prints the QPC ticks from just before CreateProcessW to main(). */\n"
+    "#include <windows.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#ifdef __cplusplus\n"
+    "extern \"C\"\n"
+    "#endif\n"
+    "int __wrap_main(int argc, char** argv) {\n"
+    "    LARGE_INTEGER now;\n"
+    "    QueryPerformanceCounter(&now);\n"
+    "    if (argc < 2) return 1;\n"
+    "    double start = strtod(argv[1], NULL);\n"
+    "    printf(\"CRUN_PROBE_QPC_TICKS=%.0f\\n\", (double)now.QuadPart - start);\n"
+    "    return 0;\n"
+    "}\n";
+
+// プローブを1回実行し、CreateProcessW の直前から main() までの時間 (us) を返す
+static BOOL run_startup_probe(const wchar_t* probe_path, double* elapsed_us) {
+    HANDLE h_read, h_write;
+    SECURITY_ATTRIBUTES sa_attr = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    if (!CreatePipe(&h_read, &h_write, &sa_attr, 0) || !SetHandleInformation(h_read, HANDLE_FLAG_INHERIT, 0)) return FALSE;
+
+    PROCESS_INFORMATION pi = {0};
+    STARTUPINFOW si = {0};
+    si.cb = sizeof(STARTUPINFOW);
+    si.dwFlags |= STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = h_write;
+    si.hStdError = h_write;
+
+    wchar_t command[MAX_PATH + 32];
+    LARGE_INTEGER start_time, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start_time);
+    swprintf_s(command, MAX_PATH + 32, L"\"%s\" %.0f", probe_path, (double)start_time.QuadPart);
+    BOOL started = CreateProcessW(NULL, command, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    CloseHandle(h_write);
+    if (!started) { CloseHandle(h_read); return FALSE; }
+
+    char output[256];
+    DWORD total = 0, bytes_read;
+    while (total < sizeof(output) - 1 && ReadFile(h_read, output + total, (DWORD)(sizeof(output) - 1 - total), &bytes_read, NULL) && bytes_read != 0) {
+        total += bytes_read;
+    }
+    output[total] = '\0';
+    CloseHandle(h_read);
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exit_code = 1;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    const char* marker = strstr(output, "CRUN_PROBE_QPC_TICKS=");
+    if (exit_code != 0 || !marker) return FALSE;
+    *elapsed_us = strtod(marker + 21, NULL) * 1000000.0 / (double)frequency.QuadPart;
+    return TRUE;
+}
+
+// プローブを複数回実行して main() までの時間を計測する
+static void measure_time_to_main(const wchar_t* probe_path, SizeReport* report) {
+    double sum = 0.0, min_us = 0.0;
+    int runs = 0;
+    for (int i = 0; i < SIZE_REPORT_PROBE_RUNS; ++i) {
+        double us;
+        if (!run_startup_probe(probe_path, &us)) continue;
+        sum += us;
+        if (runs == 0 || us < min_us) min_us = us;
+        runs++;
+    }
+    report->has_time_to_main = runs > 0;
+    report->time_to_main_runs = runs;
+    if (runs > 0) {
+        report->time_to_main_us = sum / runs;
+        report->time_to_main_min_us = min_us;
+    }
+}
+
+// 1つのレポートを表示する
+static void print_size_report(const SizeReport* report) {
+    wprintf(L"\n--- Size report: %s ---\n", report->label);
+    if (!report->built) { wprintf(L"Build failed. Run without --size-report to see compiler errors.\n"); return; }
+    wprintf(L"File size:     %lu bytes (with symbol table)\n", report->file_size);
+    wprintf(L"Stripped size: %lu bytes (estimated)\n", report->stripped_size);
+    wprintf(L"Imports:      ");
+    for (int i = 0; i < report->num_imports; ++i) wprintf(L" %S", report->imports[i]);
+    wprintf(L"\n\nSections:\n  %-20s %12s %12s\n", L"Name", L"VirtualSize", L"RawSize");
+    for (int i = 0; i < report->num_sections; ++i) {
+        const SectionInfo* sec = &report->sections[i];
+        wprintf(L"  %-20S %12lu %12lu%s\n", sec->name, sec->virtual_size, sec->raw_size, sec->is_debug ? L"  (removed by strip)" : L"");
+    }
+    wprintf(L"\nTop %d symbols by size (of %d):\n  %10s  %-10s %s\n", report->num_top_symbols, report->num_symbols, L"Size", L"Section", L"Name");
+    for (int i = 0; i < report->num_top_symbols; ++i) {
+        const SymbolInfo* sym = &report->top_symbols[i];
+        wprintf(L"  %10lu  %-10S %S\n", sym->size, sym->section, sym->name);
+    }
+    if (report->has_time_to_main) {
+        wprintf(L"\nTime to main(): %.1f us (min %.1f us, %d runs)\n", report->time_to_main_us, report->time_to_main_min_us, report->time_to_main_runs);
+    } else {
+        wprintf(L"\nTime to main(): n/a (the program has no main() or the probe failed)\n");
+    }
+}
+
+// JSON文字列として書き出す (UTF-8)
+static void write_json_string(FILE* fp, const char* s) {
+    fputc('"', fp);
+    for (; *s; ++s) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') { fputc('\\', fp); fputc(ch, fp); }
+        else if (ch < 0x20) fprintf(fp, "\\u%04x", ch);
+        else fputc(ch, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_json_wide_string(FILE* fp, const wchar_t* s) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+    char* utf8 = len > 0 ? (char*)malloc(len) : NULL;
+    if (utf8 && WideCharToMultiByte(CP_UTF8, 0, s, -1, utf8, len, NULL, NULL) > 0) {
+        write_json_string(fp, utf8);
+    } else {
+        write_json_string(fp, "");
+    }
+    free(utf8);
+}
+
+// レポートをJSONで書き出す
+static BOOL write_size_report_json(const wchar_t* json_path, const wchar_t* source_stem, const wchar_t* flags, const SizeReport* reports, int num_reports) {
+    FILE* fp = _wfopen(json_path, L"wb");
+    if (!fp) return FALSE;
+    fprintf(fp, "{\n  \"program\": ");
+    write_json_wide_string(fp, source_stem);
+    fprintf(fp, ",\n  \"flags\": ");
+    write_json_wide_string(fp, flags);
+    fprintf(fp, ",\n  \"variants\": [");
+    for (int r = 0; r < num_reports; ++r) {
+        const SizeReport* report = &reports[r];
+        fprintf(fp, "%s\n    {\n      \"name\": ", r ? "," : "");
+        write_json_wide_string(fp, report->label);
+        fprintf(fp, ",\n      \"built\": %s", report->built ? "true" : "false");
+        if (report->built) {
+            fprintf(fp, ",\n      \"file_size\": %lu,\n      \"stripped_size\": %lu,\n      \"imports\": [", report->file_size, report->stripped_size);
+            for (int i = 0; i < report->num_imports; ++i) {
+                if (i) fprintf(fp, ", ");
+                write_json_string(fp, report->imports[i]);
+            }
+            fprintf(fp, "],\n      \"sections\": [");
+            for (int i = 0; i < report->num_sections; ++i) {
+                const SectionInfo* sec = &report->sections[i];
+                fprintf(fp, "%s\n        {\"name\": ", i ? "," : "");
+                write_json_string(fp, sec->name);
+                fprintf(fp, ", \"virtual_size\": %lu, \"raw_size\": %lu, \"debug\": %s}", sec->virtual_size, sec->raw_size, sec->is_debug ? "true" : "false");
+            }
+            fprintf(fp, "\n      ],\n      \"symbol_count\": %d,\n      \"top_symbols\": [", report->num_symbols);
+            for (int i = 0; i < report->num_top_symbols; ++i) {
+                const SymbolInfo* sym = &report->top_symbols[i];
+                fprintf(fp, "%s\n        {\"name\": ", i ? "," : "");
+                write_json_string(fp, sym->name);
+                fprintf(fp, ", \"section\": ");
+                write_json_string(fp, sym->section);
+                fprintf(fp, ", \"size\": %lu}", sym->size);
+            }
+            fprintf(fp, "\n      ],\n      \"time_to_main_us\": ");
+            if (report->has_time_to_main) {
+                fprintf(fp, "{\"mean\": %.1f, \"min\": %.1f, \"runs\": %d}", report->time_to_main_us, report->time_to_main_min_us, report->time_to_main_runs);
+            } else {
+                fprintf(fp, "null");
+            }
+        }
+        fprintf(fp, "\n    }");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    return TRUE;
+}
+
+// 実行ファイルをシンボル表付きでビルドし、サイズと main() までの時間をレポートする
+int run_size_report(const ProgramOptions* opts, const wchar_t* compiler_path, const wchar_t* all_source_files_str,
+                    const wchar_t* auto_flags, const wchar_t* temp_dir, const wchar_t* source_stem) {
+    // シンボル表を残すため -s を外す (strip 後のサイズは解析結果から推定する)
+    wchar_t report_flags[128 + LIB_FLAGS_SIZE];
+    wcscpy_s(report_flags, 128 + LIB_FLAGS_SIZE, auto_flags);
+    remove_flag_token(report_flags, L"-s");
+    // --cflags に strip 指定があるとシンボル表が空になるので、こちらからも外す
+    wchar_t* user_flags = _wcsdup(opts->compiler_flags ? opts->compiler_flags : L"");
+    if (!user_flags) { fwprintf_err(L"Error: Failed to allocate memory for the size report.\n"); return 1; }
+    remove_flag_token(user_flags, L"-s");
+    remove_flag_token(user_flags, L"-Wl,-s");
+    remove_flag_token(user_flags, L"-Wl,--strip-all");
+
+    // 計測用スタブを一時ディレクトリに書き出す
+    wchar_t probe_source[MAX_PATH];
+    swprintf_s(probe_source, MAX_PATH, L"%s\\crun_startup_probe.c", temp_dir);
+    FILE* fp = _wfopen(probe_source, L"wb");
+    if (!fp) { fwprintf_err(L"Error: Failed to write the startup probe.\n"); free(user_flags); return 1; }
+    fputs(g_startup_probe_source, fp);
+    fclose(fp);
+
+    int num_reports = opts->size_report_static ? 2 : 1;
+    SizeReport* reports = (SizeReport*)calloc(num_reports, sizeof(SizeReport));
+    wchar_t* command = (wchar_t*)malloc(32767 * sizeof(wchar_t));
+    if (!reports || !command) {
+        fwprintf_err(L"Error: Failed to allocate memory for the size report.\n");
+        free(reports); free(command); free(user_flags);
+        return 1;
+    }
+    reports[0].label = L"dynamic";
+    if (num_reports > 1) reports[1].label = L"static";
+
+    // 各バリアントの本体とプローブを並列にビルドする
+    wchar_t exe_paths[2][MAX_PATH], probe_paths[2][MAX_PATH];
+    wchar_t* build_commands[4];
+    BOOL build_ok[4];
+    int num_builds = 0;
+    for (int r = 0; r < num_reports; ++r) {
+        const wchar_t* link_mode = (r == 1) ? L" -static" : L"";
+        swprintf_s(exe_paths[r], MAX_PATH, L"%s\\%s_%s.exe", temp_dir, source_stem, reports[r].label);
+        swprintf_s(probe_paths[r], MAX_PATH, L"%s\\%s_%s_probe.exe", temp_dir, source_stem, reports[r].label);
+        for (int probe = 0; probe < 2; ++probe) {
+            swprintf_s(command, 32767, L"\"%s\" %s%s%s%s -o \"%s\" %s%s %s",
+                compiler_path, all_source_files_str,
+                probe ? L" \"" : L"", probe ? probe_source : L"", probe ? L"\"" : L"",
+                probe ? probe_paths[r] : exe_paths[r], report_flags, link_mode,
+                probe ? L"-Wl,--wrap=main" : L"");
+            if (user_flags[0]) { wcscat_s(command, 32767, L" "); wcscat_s(command, 32767, user_flags); }
+            if (opts->verbose) wprintf(L"Command: %s\n", command);
+            build_commands[num_builds++] = _wcsdup(command); // r * 2 + probe の順
+        }
+    }
+    run_commands_parallel(build_commands, num_builds, num_builds, FALSE, build_ok, NULL);
+    BOOL probe_built[2] = {FALSE, FALSE};
+    for (int i = 0; i < num_builds; ++i) {
+        if (i % 2) probe_built[i / 2] = build_ok[i];
+        else reports[i / 2].built = build_ok[i];
+        free(build_commands[i]);
+    }
+
+    // 解析と計測
+    int result = 0;
+    for (int r = 0; r < num_reports; ++r) {
+        if (reports[r].built && !analyze_pe_file(exe_paths[r], &reports[r])) {
+            fwprintf_err(L"Warning: Could not parse %s as a PE executable.\n", exe_paths[r]);
+            reports[r].built = FALSE;
+        }
+        if (!reports[r].built) result = 1;
+        else if (probe_built[r]) measure_time_to_main(probe_paths[r], &reports[r]);
+        print_size_report(&reports[r]);
+    }
+
+    // 静的リンクとの比較
+    if (num_reports > 1 && reports[0].built && reports[1].built) {
+        // MinGW の -static で静的リンクされるのは libgcc/libstdc++/winpthread だけで、C ランタイム (msvcrt/ucrt) は常に DLL
+        wprintf(L"\n--- Dynamic vs static linking (libgcc/libstdc++/winpthread only; the C runtime DLL is used in both) ---\n");
+        wprintf(L"  %-16s %14s %14s\n", L"", L"dynamic", L"static");
+        wprintf(L"  %-16s %14lu %14lu\n", L"Stripped size", reports[0].stripped_size, reports[1].stripped_size);
+        wprintf(L"  %-16s %14d %14d\n", L"Imported DLLs", reports[0].num_imports, reports[1].num_imports);
+        if (reports[0].has_time_to_main && reports[1].has_time_to_main) {
+            wprintf(L"  %-16s %11.1f us %11.1f us\n", L"Time to main()", reports[0].time_to_main_us, reports[1].time_to_main_us);
+        }
+    }
+
+    if (opts->size_report_json) {
+        if (write_size_report_json(opts->size_report_json, source_stem, report_flags, reports, num_reports)) {
+            if (opts->verbose) wprintf(L"\nSize report written to %s\n", opts->size_report_json);
+        } else {
+            fwprintf_err(L"Error: Failed to write %s\n", opts->size_report_json);
+            result = 1;
+        }
+    }
+
+    free(command); free(reports); free(user_flags);
+    return result;
+}
+
+// --- Pipeline Implementation ---
+// --- 起動処理のパイプラインの実装 ---
+
+// ワーカースレッドを起動する。スレッドを作れない場合はその場で実行して NULL を返す。
+HANDLE start_worker(LPTHREAD_START_ROUTINE proc, LPVOID param) {
+    HANDLE h_thread = CreateThread(NULL, 0, proc, param, 0, NULL);
+    if (!h_thread) proc(param);
+    return h_thread;
+}
+
+// ワーカースレッドの終了を待つ (待機済みのハンドルは NULL になるので何度呼んでもよい)
+void join_workers(HANDLE* workers, int num_workers) {
+    for (int i = 0; i < num_workers; ++i) {
+        if (workers[i]) {
+            WaitForSingleObject(workers[i], INFINITE);
+            CloseHandle(workers[i]);
+            workers[i] = NULL;
+        }
+    }
+}
+
+// キューからソースを取り出し、読み込んでインクルードしているヘッダを調べる
+DWORD WINAPI scan_worker(LPVOID param) {
+    ScanQueue* queue = (ScanQueue*)param;
+    for (;;) {
+        LONG index = InterlockedIncrement(&queue->next) - 1;
+        if (index >= queue->num_tasks) break;
+        ScanTask* task = &queue->tasks[index];
+
+        LARGE_INTEGER start_time, end_time;
+        QueryPerformanceCounter(&start_time);
+        wchar_t* source_content = NULL;
+        task->read_ok = read_file_content_wide(task->full_path, &source_content);
+        if (task->read_ok) {
+            for (int r = 0; r < NUM_AUTO_LINK_RULES; ++r) {
+                if (wcsstr(source_content, g_auto_link_rules[r].header)) task->rule_mask |= (DWORD)1 << r;
+            }
+            free(source_content); // メモリを解放
+        }
+        QueryPerformanceCounter(&end_time);
+        task->elapsed_ms = elapsed_ms_between(&start_time, &end_time);
+    }
+    return 0;
+}
+
+// PATH環境変数からコンパイラを検索する
+DWORD WINAPI toolchain_worker(LPVOID param) {
+    ToolchainTask* task = (ToolchainTask*)param;
+    LARGE_INTEGER start_time, end_time;
+    QueryPerformanceCounter(&start_time);
+    task->found = find_executable_in_path(task->exe_name, task->path, MAX_PATH);
+    if (!task->found) task->path[0] = L'\0';
+    QueryPerformanceCounter(&end_time);
+    task->elapsed_ms = elapsed_ms_between(&start_time, &end_time);
+    return 0;
+}
+
+// 一時ディレクトリを作成する
+DWORD WINAPI workspace_worker(LPVOID param) {
+    WorkspaceTask* task = (WorkspaceTask*)param;
+    LARGE_INTEGER start_time, end_time;
+    QueryPerformanceCounter(&start_time);
+    task->created = CreateDirectoryW(task->temp_dir, NULL);
+    QueryPerformanceCounter(&end_time);
+    task->elapsed_ms = elapsed_ms_between(&start_time, &end_time);
+    return 0;
+}
+
+// 解析結果からリンクフラグを組み立てる (同じフラグは一度だけ追加)
+void append_auto_link_flags(const ScanTask* tasks, int num_tasks, const wchar_t* compiler_path,
+                            wchar_t* lib_flags, size_t lib_flags_size) {
+    DWORD mask = 0;
+    BOOL needs_fallback = FALSE;
+    for (int i = 0; i < num_tasks; ++i) {
+        mask |= tasks[i].rule_mask;
+        if (!tasks[i].read_ok) needs_fallback = TRUE;
+    }
+    for (int r = 0; r < NUM_AUTO_LINK_RULES; ++r) {
+        if (!(mask & ((DWORD)1 << r)) || contains_flag_token(lib_flags, g_auto_link_rules[r].flags)) continue;
+        wcscat_s(lib_flags, lib_flags_size, L" ");
+        wcscat_s(lib_flags, lib_flags_size, g_auto_link_rules[r].flags);
+    }
+
+    if (needs_fallback && compiler_path[0] != L'\0') {
+        // ファイルが読み込めない場合、従来のヘッダ依存性チェックにフォールバック
+        wchar_t* dep_command = (wchar_t*)malloc(32767 * sizeof(wchar_t));
+        if (!dep_command) return;
+        swprintf_s(dep_command, 32767, L"\"%s\" -MM", compiler_path);
+        BOOL fits = TRUE;
+        for (int i = 0; i < num_tasks && fits; ++i) {
+            // コマンドラインに収まらない場合はフォールバックを諦める
+            fits = wcslen(dep_command) + wcslen(tasks[i].full_path) + 3 < 32767;
+            if (fits) {
+                wcscat_s(dep_command, 32767, L" \"");
+                wcscat_s(dep_command, 32767, tasks[i].full_path);
+                wcscat_s(dep_command, 32767, L"\"");
+            }
+        }
+        wchar_t* dep_output = NULL;
+        if (fits && run_process_and_capture_output(dep_command, &dep_output) && dep_output) {
+            if (wcsstr(dep_output, L"pthread.h") && !contains_flag_token(lib_flags, L"-lpthread")) { wcscat_s(lib_flags, lib_flags_size, L" -lpthread"); }
+            if (wcsstr(dep_output, L"math.h") && !contains_flag_token(lib_flags, L"-lm")) { wcscat_s(lib_flags, lib_flags_size, L" -lm"); }
+        }
+        free(dep_output);
+        free(dep_command);
+    }
+}
+
+// ソースのフルパスを引用符付きで並べた文字列を作る (" \"a.c\" \"b.c\"")。呼び出し側で free する
+wchar_t* build_source_list(const wchar_t (*source_full_paths)[MAX_PATH], int num_sources) {
+    size_t size = 1;
+    for (int i = 0; i < num_sources; ++i) size += wcslen(source_full_paths[i]) + 3;
+    wchar_t* list = (wchar_t*)malloc(size * sizeof(wchar_t));
+    if (!list) return NULL;
+    list[0] = L'\0';
+    for (int i = 0; i < num_sources; ++i) {
+        wcscat_s(list, size, L" \"");
+        wcscat_s(list, size, source_full_paths[i]);
+        wcscat_s(list, size, L"\"");
+    }
+    return list;
+}
+
+// --cflags をコンパイル用とリンク用に振り分ける (リンク専用のフラグは -c と一緒に渡さない)
+// 出力はどちらも元の文字列より長くならないので、flags_size は wcslen(flags) + 1 あればよい
+void split_user_flags(const wchar_t* flags, wchar_t* compile_flags, wchar_t* link_flags, size_t flags_size) {
+    static const wchar_t* link_only_prefixes[] = { L"-l", L"-L", L"-Wl,", L"-static", L"-shared", L"-mwindows", L"-mconsole" };
+    compile_flags[0] = L'\0';
+    link_flags[0] = L'\0';
+    if (!flags) return;
+
+    const wchar_t* p = flags;
+    while (*p) {
+        while (*p == L' ' || *p == L'\t') p++;
+        if (!*p) break;
+        // 引用符で囲まれた空白はトークンの区切りとみなさない
+        const wchar_t* token = p;
+        BOOL in_quotes = FALSE;
+        while (*p && (in_quotes || (*p != L' ' && *p != L'\t'))) {
+            if (*p == L'"') in_quotes = !in_quotes;
+            p++;
+        }
+        size_t len = (size_t)(p - token);
+
+        BOOL link_only = (len == 2 && wcsncmp(token, L"-s", 2) == 0);
+        for (size_t i = 0; !link_only && i < sizeof(link_only_prefixes) / sizeof(link_only_prefixes[0]); ++i) {
+            size_t prefix_len = wcslen(link_only_prefixes[i]);
+            if (len >= prefix_len && wcsncmp(token, link_only_prefixes[i], prefix_len) == 0) link_only = TRUE;
+        }
+        if (!link_only) {
+            if (compile_flags[0]) wcscat_s(compile_flags, flags_size, L" ");
+            wcsncat_s(compile_flags, flags_size, token, len);
+        }
+        if (link_flags[0]) wcscat_s(link_flags, flags_size, L" ");
+        wcsncat_s(link_flags, flags_size, token, len);
+    }
+}
+
+// フラグ文字列から単独のトークンを取り除く (例: "-O2 -s -lm" から "-s")
+void remove_flag_token(wchar_t* flags, const wchar_t* token) {
+    size_t token_len = wcslen(token);
+    wchar_t* p = flags;
+    while ((p = wcsstr(p, token)) != NULL) {
+        BOOL starts = (p == flags || p[-1] == L' ');
+        BOOL ends = (p[token_len] == L'\0' || p[token_len] == L' ');
+        if (starts && ends) {
+            wchar_t* rest = p + token_len;
+            if (*rest == L' ' && (p == flags)) rest++;
+            memmove(p, rest, (wcslen(rest) + 1) * sizeof(wchar_t));
+        } else {
+            p += token_len;
+        }
+    }
+}
+
+// ソースに対応するオブジェクトファイルのパス (同名のソースが重なっても衝突しないよう番号を付ける)
+void get_object_path(const wchar_t* temp_dir, const wchar_t* source_path, int index, wchar_t* object_path, size_t object_path_size) {
+    wchar_t stem[MAX_PATH];
+    get_stem(source_path, stem, MAX_PATH);
+    swprintf_s(object_path, object_path_size, L"%s\\%03d_%s.o", temp_dir, index, stem);
+}
+
+// フラグ文字列に token が単独のトークン (列) として含まれているか (例: "-lm" は "-lmsvcrt" に一致しない)
+BOOL contains_flag_token(const wchar_t* flags, const wchar_t* token) {
+    size_t token_len = wcslen(token);
+    for (const wchar_t* p = flags; (p = wcsstr(p, token)) != NULL; p += token_len) {
+        BOOL starts = (p == flags || p[-1] == L' ');
+        BOOL ends = (p[token_len] == L'\0' || p[token_len] == L' ');
+        if (starts && ends) return TRUE;
+    }
+    return FALSE;
+}
+
+// オブジェクトファイルの一覧をリンカのレスポンスファイルに書き出す
+// (レスポンスファイルでは '\\' がエスケープ文字になるため '/' に置き換える)
+BOOL write_object_response_file(const wchar_t* response_path, const wchar_t* temp_dir, const wchar_t (*source_full_paths)[MAX_PATH], int num_sources) {
+    FILE* fp = _wfopen(response_path, L"wb");
+    if (!fp) return FALSE;
+    BOOL ok = TRUE;
+    for (int i = 0; i < num_sources && ok; ++i) {
+        wchar_t object_path[MAX_PATH];
+        get_object_path(temp_dir, source_full_paths[i], i, object_path, MAX_PATH);
+        for (wchar_t* c = object_path; *c; ++c) if (*c == L'\\') *c = L'/';
+        char narrow_path[MAX_PATH * 3];
+        if (WideCharToMultiByte(CP_ACP, 0, object_path, -1, narrow_path, sizeof(narrow_path), NULL, NULL) == 0) { ok = FALSE; break; }
+        fprintf(fp, "\"%s\"\n", narrow_path);
+    }
+    fclose(fp);
+    return ok;
+}
+
+// QueryPerformanceCounter の2点間の経過時間 (ms)
+double elapsed_ms_between(const LARGE_INTEGER* start, const LARGE_INTEGER* end) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (double)(end->QuadPart - start->QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+// --- シンボル索引の実装 ---
+
+// 文字列の FNV-1a ハッシュ (キャッシュファイル名と検索用)
+static DWORD fnv1a_hash(const char* s) {
+    DWORD hash = 2166136261u;
+    for (; *s; ++s) hash = (hash ^ (unsigned char)*s) * 16777619u;
+    return hash;
+}
+
+// ライブラリのファイル名から -l に渡す名前を求める (対象外のファイルなら FALSE)
+static BOOL get_library_lname(const wchar_t* filename, char* lname, size_t lname_size) {
+    wchar_t name[MAX_PATH];
+    wcsncpy_s(name, MAX_PATH, filename, _TRUNCATE);
+    size_t len = wcslen(name);
+    const wchar_t* base = name;
+    if (len > 6 && _wcsicmp(name + len - 6, L".dll.a") == 0 && _wcsnicmp(name, L"lib", 3) == 0) {
+        name[len - 6] = L'\0'; base = name + 3;
+    } else if (len > 2 && _wcsicmp(name + len - 2, L".a") == 0 && _wcsnicmp(name, L"lib", 3) == 0) {
+        name[len - 2] = L'\0'; base = name + 3;
+    } else if (len > 4 && _wcsicmp(name + len - 4, L".lib") == 0) {
+        name[len - 4] = L'\0';
+    } else {
+        return FALSE;
+    }
+    if (*base == L'\0') return FALSE;
+    // 空白を含む名前は -l に渡せないので対象外
+    if (wcschr(base, L' ')) return FALSE;
+    return WideCharToMultiByte(CP_UTF8, 0, base, -1, lname, (int)lname_size, NULL, NULL) > 0;
+}
+
+// アーカイブ (ar 形式) の先頭にあるシンボル表だけを読み、'\0' 区切りのシンボル名の並びを返す
+// (ファイル全体は読まない。シンボル表がないファイルは空の並びとして扱う)
+static BOOL read_archive_symbols(const wchar_t* path, char** symbols, DWORD* symbols_size) {
+    *symbols = NULL;
+    *symbols_size = 0;
+    HANDLE h_file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h_file == INVALID_HANDLE_VALUE) return FALSE;
+    unsigned char header[68];
+    DWORD bytes_read;
+    if (!ReadFile(h_file, header, sizeof(header), &bytes_read, NULL) || bytes_read != sizeof(header) ||
+        memcmp(header, "!<arch>\n", 8) != 0) {
+        CloseHandle(h_file);
+        return TRUE;
+    }
+    // GNU/MS の "/" (4バイトの個数とオフセット) と GNU の "/SYM64/" (8バイト)
+    const unsigned char* name = header + 8;
+    int width;
+    if (memcmp(name, "/SYM64/ ", 8) == 0) width = 8;
+    else if (name[0] == '/' && name[1] == ' ') width = 4;
+    else { CloseHandle(h_file); return TRUE; }
+    char size_str[11];
+    memcpy(size_str, header + 8 + 48, 10);
+    size_str[10] = '\0';
+    DWORD member_size = (DWORD)strtoul(size_str, NULL, 10);
+    if (member_size < (DWORD)width || member_size > 256 * 1024 * 1024) { CloseHandle(h_file); return TRUE; }
+
+    unsigned char* member = (unsigned char*)malloc(member_size);
+    if (!member) { CloseHandle(h_file); return FALSE; }
+    BOOL read_ok = ReadFile(h_file, member, member_size, &bytes_read, NULL) && bytes_read == member_size;
+    CloseHandle(h_file);
+    if (!read_ok) { free(member); return TRUE; }
+
+    ULONGLONG count = 0;
+    for (int i = 0; i < width; ++i) count = (count << 8) | member[i];
+    ULONGLONG names_offset = (ULONGLONG)width + count * width;
+    if (count == 0 || names_offset >= member_size) { free(member); return TRUE; }
+
+    DWORD names_size = member_size - (DWORD)names_offset;
+    char* names = (char*)malloc(names_size + 1);
+    if (!names) { free(member); return FALSE; }
+    memcpy(names, member + names_offset, names_size);
+    names[names_size] = '\0';
+    free(member);
+    // 個数分の名前だけを残す (末尾のパディングを除く)
+    DWORD pos = 0;
+    for (ULONGLONG i = 0; i < count && pos < names_size; ++i) pos += (DWORD)strlen(names + pos) + 1;
+    *symbols = names;
+    *symbols_size = pos;
+    return TRUE;
+}
+
+// 索引にライブラリを1つ追加する
+static LibraryEntry* add_library_entry(SymbolIndex* index) {
+    if (index->num_libs == index->capacity) {
+        int new_capacity = index->capacity ? index->capacity * 2 : 256;
+        LibraryEntry* new_libs = (LibraryEntry*)realloc(index->libs, new_capacity * sizeof(LibraryEntry));
+        if (!new_libs) return NULL;
+        index->libs = new_libs;
+        index->capacity = new_capacity;
+    }
+    LibraryEntry* entry = &index->libs[index->num_libs++];
+    memset(entry, 0, sizeof(LibraryEntry));
+    return entry;
+}
+
+// キャッシュファイルのパスを求める (%LOCALAPPDATA%\crun\symbols_<コンパイラのパスのハッシュ>.idx)
+static BOOL get_symbol_cache_path(const wchar_t* compiler_path, wchar_t* cache_path, size_t cache_path_size) {
+    wchar_t base_dir[MAX_PATH];
+    DWORD len = GetEnvironmentVariableW(L"LOCALAPPDATA", base_dir, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH) {
+        len = GetTempPathW(MAX_PATH, base_dir);
+        if (len == 0 || len >= MAX_PATH) return FALSE;
+        if (base_dir[len - 1] == L'\\') base_dir[len - 1] = L'\0';
+    }
+    wchar_t cache_dir[MAX_PATH];
+    swprintf_s(cache_dir, MAX_PATH, L"%s\\crun", base_dir);
+    CreateDirectoryW(cache_dir, NULL); // 既に存在する場合の失敗は無視
+
+    char narrow_compiler[MAX_PATH * 3];
+    if (WideCharToMultiByte(CP_UTF8, 0, compiler_path, -1, narrow_compiler, sizeof(narrow_compiler), NULL, NULL) == 0) return FALSE;
+    for (char* c = narrow_compiler; *c; ++c) if (*c >= 'A' && *c <= 'Z') *c = (char)(*c - 'A' + 'a');
+    swprintf_s(cache_path, cache_path_size, L"%s\\symbols_%08lx.idx", cache_dir, (unsigned long)fnv1a_hash(narrow_compiler));
+    return TRUE;
+}
+
+// キャッシュファイルを読み込む
+// 形式: 1行目がヘッダ、"L\t<サイズ>\t<更新日時>\t<名前>\t<パス>" の行に続けてそのライブラリのシンボルを1行に1つ、
+//       最後の行が "E\t<ライブラリ数>"。終端の行がない・数が合わないキャッシュは途中で切れたものとして捨てる
+static void load_symbol_cache(const wchar_t* cache_path, SymbolIndex* index) {
+    unsigned char* data;
+    DWORD size;
+    if (!read_file_bytes(cache_path, &data, &size)) return;
+    data[size] = '\0';
+    char* text = (char*)data;
+    size_t header_len = strlen(SYMBOL_INDEX_HEADER);
+    if (size <= header_len || strncmp(text, SYMBOL_INDEX_HEADER, header_len) != 0 || text[header_len] != '\n') {
+        free(data);
+        return;
+    }
+    // 終端の行を確認し、そこで本文を打ち切る
+    if (text[size - 1] != '\n') { free(data); return; }
+    text[size - 1] = '\0';
+    char* end_line = strrchr(text, '\n');
+    if (!end_line || strncmp(end_line + 1, "E\t", 2) != 0) { free(data); return; }
+    int expected_libs = atoi(end_line + 3);
+    end_line[1] = '\0';
+
+    char* p = text + header_len + 1;
+    while (*p) {
+        char* line_end = strchr(p, '\n');
+        if (!line_end) break;
+        *line_end = '\0';
+        if (strncmp(p, "L\t", 2) != 0) { p = line_end + 1; continue; }
+
+        // ライブラリの行を解析する
+        char* fields[4];
+        char* q = p + 2;
+        int num_fields = 0;
+        while (num_fields < 4) {
+            fields[num_fields++] = q;
+            if (num_fields == 4) break;
+            q = strchr(q, '\t');
+            if (!q) break;
+            *q++ = '\0';
+        }
+        p = line_end + 1;
+        if (num_fields != 4) continue;
+
+        // 続くシンボルの行をまとめる (次の "L\t" の行まで)
+        char* symbols_start = p;
+        while (*p && strncmp(p, "L\t", 2) != 0) {
+            char* symbol_end = strchr(p, '\n');
+            if (!symbol_end) { p += strlen(p); break; }
+            *symbol_end = '\0';
+            p = symbol_end + 1;
+        }
+        LibraryEntry* entry = add_library_entry(index);
+        if (!entry) break;
+        entry->size = _strtoui64(fields[0], NULL, 10);
+        entry->mtime = _strtoui64(fields[1], NULL, 10);
+        strncpy_s(entry->lname, sizeof(entry->lname), fields[2], _TRUNCATE);
+        if (MultiByteToWideChar(CP_UTF8, 0, fields[3], -1, entry->path, MAX_PATH) == 0) { index->num_libs--; continue; }
+        entry->symbols_size = (DWORD)(p - symbols_start);
+        entry->symbols = (char*)malloc(entry->symbols_size + 1);
+        if (!entry->symbols) { index->num_libs--; break; }
+        memcpy(entry->symbols, symbols_start, entry->symbols_size);
+        entry->symbols[entry->symbols_size] = '\0';
+    }
+    free(data);
+    if (index->num_libs != expected_libs) free_symbol_index(index);
+}
+
+// キャッシュファイルを書き出す
+// (同じディレクトリの一時ファイルに書いてから置き換えるので、書き込み中に中断されたり
+//  他の crun が同時に読んだりしても、途中までのキャッシュが読まれることはない)
+static void save_symbol_cache(const wchar_t* cache_path, const SymbolIndex* index) {
+    wchar_t temp_path[MAX_PATH];
+    swprintf_s(temp_path, MAX_PATH, L"%s.%lu.tmp", cache_path, GetCurrentProcessId());
+    FILE* fp = _wfopen(temp_path, L"wb");
+    if (!fp) return;
+    fprintf(fp, "%s\n", SYMBOL_INDEX_HEADER);
+    int num_written = 0;
+    for (int i = 0; i < index->num_libs; ++i) {
+        const LibraryEntry* entry = &index->libs[i];
+        char narrow_path[MAX_PATH * 3];
+        if (WideCharToMultiByte(CP_UTF8, 0, entry->path, -1, narrow_path, sizeof(narrow_path), NULL, NULL) == 0) continue;
+        fprintf(fp, "L\t%I64u\t%I64u\t%s\t%s\n", entry->size, entry->mtime, entry->lname, narrow_path);
+        for (DWORD pos = 0; pos < entry->symbols_size; pos += (DWORD)strlen(entry->symbols + pos) + 1) {
+            if (entry->symbols[pos] != '\0') fprintf(fp, "%s\n", entry->symbols + pos);
+        }
+        num_written++;
+    }
+    fprintf(fp, "E\t%d\n", num_written);
+    BOOL write_ok = !ferror(fp);
+    if (fclose(fp) != 0) write_ok = FALSE;
+    if (!write_ok || !MoveFileExW(temp_path, cache_path, MOVEFILE_REPLACE_EXISTING)) DeleteFileW(temp_path);
+}
+
+// コンパイラのライブラリ検索パスを取得する ("-print-search-dirs" の "libraries: =" の行)
+static int get_library_search_dirs(const wchar_t* compiler_path, wchar_t (*dirs)[MAX_PATH], int max_dirs) {
+    wchar_t command[MAX_PATH + 32];
+    swprintf_s(command, MAX_PATH + 32, L"\"%s\" -print-search-dirs", compiler_path);
+    wchar_t* output = NULL;
+    int num_dirs = 0;
+    if (run_process_and_capture_output(command, &output) && output) {
+        wchar_t* line = wcsstr(output, L"libraries: =");
+        if (line) {
+            line += wcslen(L"libraries: =");
+            wchar_t* line_end = wcspbrk(line, L"\r\n");
+            if (line_end) *line_end = L'\0';
+            wchar_t* context = NULL;
+            for (wchar_t* token = wcstok_s(line, L";", &context); token && num_dirs < max_dirs; token = wcstok_s(NULL, L";", &context)) {
+                wchar_t full_dir[MAX_PATH];
+                if (!GetFullPathNameW(token, MAX_PATH, full_dir, NULL)) continue;
+                size_t len = wcslen(full_dir);
+                if (len > 3 && full_dir[len - 1] == L'\\') full_dir[len - 1] = L'\0';
+                DWORD attributes = GetFileAttributesW(full_dir);
+                if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) continue;
+                BOOL duplicate = FALSE;
+                for (int i = 0; i < num_dirs && !duplicate; ++i) duplicate = (_wcsicmp(dirs[i], full_dir) == 0);
+                if (!duplicate) wcscpy_s(dirs[num_dirs++], MAX_PATH, full_dir);
+            }
+        }
+    }
+    free(output);
+    return num_dirs;
+}
+
+// 1つのディレクトリのライブラリを、走査した順に index へ追加する
+// (cached に同じパスでサイズと更新日時が同じものがあればそれを移し、なければ読み直す)
+static void index_library_dir(const wchar_t* dir, const wchar_t* pattern, SymbolIndex* cached, SymbolIndex* index, int* num_updated) {
+    wchar_t search_path[MAX_PATH];
+    swprintf_s(search_path, MAX_PATH, L"%s\\%s", dir, pattern);
+    WIN32_FIND_DATAW find_data;
+    HANDLE h_find = FindFirstFileW(search_path, &find_data);
+    if (h_find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        char lname[64];
+        if (!get_library_lname(find_data.cFileName, lname, sizeof(lname))) continue;
+        wchar_t path[MAX_PATH];
+        swprintf_s(path, MAX_PATH, L"%s\\%s", dir, find_data.cFileName);
+        ULONGLONG size = ((ULONGLONG)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+        ULONGLONG mtime = ((ULONGLONG)find_data.ftLastWriteTime.dwHighDateTime << 32) | find_data.ftLastWriteTime.dwLowDateTime;
+
+        // 別のパターンやディレクトリの重複で同じファイルを二度追加しない
+        BOOL duplicate = FALSE;
+        for (int i = 0; i < index->num_libs && !duplicate; ++i) duplicate = (_wcsicmp(index->libs[i].path, path) == 0);
+        if (duplicate) continue;
+
+        LibraryEntry* cached_entry = NULL;
+        for (int i = 0; i < cached->num_libs && !cached_entry; ++i) {
+            if (cached->libs[i].symbols && _wcsicmp(cached->libs[i].path, path) == 0) cached_entry = &cached->libs[i];
+        }
+        if (cached_entry && cached_entry->size == size && cached_entry->mtime == mtime) {
+            LibraryEntry* entry = add_library_entry(index);
+            if (!entry) break;
+            *entry = *cached_entry;
+            cached_entry->symbols = NULL; // 所有権を移す
+            continue;
+        }
+
+        char* symbols;
+        DWORD symbols_size;
+        if (!read_archive_symbols(path, &symbols, &symbols_size)) continue;
+        LibraryEntry* entry = add_library_entry(index);
+        if (!entry) { free(symbols); break; }
+        wcscpy_s(entry->path, MAX_PATH, path);
+        strcpy_s(entry->lname, sizeof(entry->lname), lname);
+        entry->size = size;
+        entry->mtime = mtime;
+        entry->symbols = symbols;
+        entry->symbols_size = symbols_size;
+        (*num_updated)++;
+    } while (FindNextFileW(h_find, &find_data) != 0);
+    FindClose(h_find);
+}
+
+// ツールチェーンのライブラリのシンボル索引を用意する
+// (キャッシュを読み、追加・変更されたライブラリだけを読み直し、消えたライブラリを取り除く。
+//  並び順は毎回ディレクトリの走査順で作り直すので、検索パスの先にあるライブラリが優先される)
+BOOL update_symbol_index(const wchar_t* compiler_path, SymbolIndex* index, BOOL verbose) {
+    LARGE_INTEGER start_time, end_time;
+    QueryPerformanceCounter(&start_time);
+
+    wchar_t dirs[64][MAX_PATH];
+    int num_dirs = get_library_search_dirs(compiler_path, dirs, 64);
+    if (num_dirs == 0) {
+        if (verbose) wprintf(L"Symbol index: could not get library search directories from %s\n", compiler_path);
+        return FALSE;
+    }
+
+    wchar_t cache_path[MAX_PATH];
+    BOOL has_cache_path = get_symbol_cache_path(compiler_path, cache_path, MAX_PATH);
+    SymbolIndex cached = {0};
+    if (has_cache_path) load_symbol_cache(cache_path, &cached);
+
+    // 検索パスの順に走査する (同じシンボルが複数のライブラリにあるときは索引で先にあるものを使う)
+    int num_updated = 0;
+    for (int d = 0; d < num_dirs; ++d) {
+        index_library_dir(dirs[d], L"*.a", &cached, index, &num_updated);
+        index_library_dir(dirs[d], L"*.lib", &cached, index, &num_updated);
+    }
+
+    // キャッシュに残ったもの (所有権を移さなかったもの) は見つからなくなったライブラリ
+    int num_removed = 0;
+    for (int i = 0; i < cached.num_libs; ++i) {
+        if (cached.libs[i].symbols) num_removed++;
+    }
+    int num_cached = index->num_libs - num_updated;
+    // 追加・変更・削除があったか、順序が変わった場合はキャッシュを書き直す
+    index->dirty = (num_updated > 0 || num_removed > 0 || cached.num_libs != index->num_libs);
+    for (int i = 0; !index->dirty && i < index->num_libs; ++i) {
+        index->dirty = (_wcsicmp(cached.libs[i].path, index->libs[i].path) != 0);
+    }
+    free_symbol_index(&cached);
+
+    if (index->dirty && has_cache_path) save_symbol_cache(cache_path, index);
+
+    QueryPerformanceCounter(&end_time);
+    if (verbose) {
+        wprintf(L"Symbol index: %d libraries in %d directories (%d cached, %d updated, %d removed) in %.1f ms\n",
+            index->num_libs, num_dirs, num_cached, num_updated, num_removed, elapsed_ms_between(&start_time, &end_time));
+        if (has_cache_path) wprintf(L"Symbol index cache: %s\n", cache_path);
+    }
+    return index->num_libs > 0;
+}
+
+// リンカの出力に未定義シンボルのエラーがあるか
+BOOL has_undefined_symbols(const wchar_t* link_output) {
+    return wcsstr(link_output, L"undefined reference to `") != NULL || wcsstr(link_output, L"undefined symbol: ") != NULL;
+}
+
+// リンカの出力から未定義シンボル名を取り出す
+// GNU ld: "undefined reference to `name'"、lld: "undefined symbol: name" (dllimport は "__imp_name" に直す)
+static int collect_undefined_symbols(const wchar_t* link_output, char (*symbols)[256], int max_symbols) {
+    static const struct { const wchar_t* prefix; wchar_t terminator; } patterns[] = {
+        { L"undefined reference to `", L'\'' },
+        { L"undefined symbol: ", L'\n' },
+    };
+    int num_symbols = 0;
+    for (int p = 0; p < 2; ++p) {
+        size_t prefix_len = wcslen(patterns[p].prefix);
+        for (const wchar_t* s = wcsstr(link_output, patterns[p].prefix); s && num_symbols < max_symbols; s = wcsstr(s, patterns[p].prefix)) {
+            s += prefix_len;
+            wchar_t name[256];
+            size_t len = 0;
+            while (s[len] && s[len] != patterns[p].terminator && s[len] != L'\r' && s[len] != L'\n' && len < 255) {
+                name[len] = s[len];
+                len++;
+            }
+            name[len] = L'\0';
+            wchar_t imp_name[256];
+            const wchar_t* dllimport = L"__declspec(dllimport) ";
+            if (wcsncmp(name, dllimport, wcslen(dllimport)) == 0) {
+                swprintf_s(imp_name, 256, L"__imp_%s", name + wcslen(dllimport));
+                wcscpy_s(name, 256, imp_name);
+            }
+            // デマングルされた C++ の名前はアーカイブのシンボル名と照合できないので対象外
+            if (name[0] == L'\0' || wcspbrk(name, L" (:<")) continue;
+            char narrow_name[256];
+            if (WideCharToMultiByte(CP_UTF8, 0, name, -1, narrow_name, sizeof(narrow_name), NULL, NULL) == 0) continue;
+            BOOL duplicate = FALSE;
+            for (int i = 0; i < num_symbols && !duplicate; ++i) duplicate = (strcmp(symbols[i], narrow_name) == 0);
+            if (!duplicate) strcpy_s(symbols[num_symbols++], 256, narrow_name);
+        }
+    }
+    return num_symbols;
+}
+
+// C ランタイムとコンパイラのランタイムのライブラリ (ドライバが既定でリンクする)。
+// MinGW には同じ CRT 関数を公開する libmsvcr*.a / libucrt*.a などが多数あり、
+// ここから選ぶと C ランタイムが混在するため、未定義シンボルの解決には使わない。
+static BOOL is_runtime_library(const char* lname) {
+    static const char* runtime_prefixes[] = {
+        "msvcr", "msvcp", "ucrt", "crtdll", "api-ms-win-crt", "vcruntime", "moldname",
+        "mingw", "gcc", "stdc++", "supc++", "c++", "unwind", "compiler-rt", "clang_rt"
+    };
+    for (size_t i = 0; i < sizeof(runtime_prefixes) / sizeof(runtime_prefixes[0]); ++i) {
+        if (_strnicmp(lname, runtime_prefixes[i], strlen(runtime_prefixes[i])) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+// 多数の DLL の関数をまとめて公開する包括ライブラリ (API セットや OneCore 向け)。
+// 名前順の走査では libwinmm.a などより先に見つかるが、個別の DLL のライブラリを優先したいので、
+// ほかのどのライブラリでも見つからなかったシンボルにだけ使う。
+static BOOL is_umbrella_library(const char* lname) {
+    static const char* umbrella_prefixes[] = {
+        "api-ms-win-", "ext-ms-", "mincore", "onecore", "windowsapp"
+    };
+    for (size_t i = 0; i < sizeof(umbrella_prefixes) / sizeof(umbrella_prefixes[0]); ++i) {
+        if (_strnicmp(lname, umbrella_prefixes[i], strlen(umbrella_prefixes[i])) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+// 未定義シンボルを索引から引き、必要なライブラリを " -lfoo -lbar" の形で resolved_libs に書き出す
+// (既に lib_flags にあるライブラリとランタイムのライブラリは使わない。
+//  resolved にはシンボルごとに選んだライブラリを記録する。戻り値は追加したライブラリの数)
+int resolve_undefined_symbols(const wchar_t* link_output, const SymbolIndex* index, const wchar_t* lib_flags,
+                              ResolvedSymbol* resolved, int* num_resolved, wchar_t* resolved_libs, size_t resolved_libs_size) {
+    *num_resolved = 0;
+    resolved_libs[0] = L'\0';
+    char (*symbols)[256] = (char (*)[256])malloc(MAX_UNDEFINED_SYMBOLS * 256);
+    if (!symbols) return 0;
+    int num_symbols = collect_undefined_symbols(link_output, symbols, MAX_UNDEFINED_SYMBOLS);
+
+    // 名前の揺れを吸収する候補 (i686 の先頭の '_'、dllimport の "__imp_" の有無)
+    enum { NUM_VARIANTS = 4 };
+    char (*candidates)[NUM_VARIANTS][264] = (char (*)[NUM_VARIANTS][264])malloc(MAX_UNDEFINED_SYMBOLS * sizeof(*candidates));
+    DWORD (*hashes)[NUM_VARIANTS] = (DWORD (*)[NUM_VARIANTS])malloc(MAX_UNDEFINED_SYMBOLS * sizeof(*hashes));
+    int* found_lib = (int*)malloc(MAX_UNDEFINED_SYMBOLS * sizeof(int));
+    if (!candidates || !hashes || !found_lib) { free(symbols); free(candidates); free(hashes); free(found_lib); return 0; }
+    for (int i = 0; i < num_symbols; ++i) {
+        const char* name = symbols[i];
+        sprintf_s(candidates[i][0], 264, "%s", name);
+        sprintf_s(candidates[i][1], 264, "_%s", name);
+        if (strncmp(name, "__imp_", 6) == 0) sprintf_s(candidates[i][2], 264, "%s", name + 6);
+        else sprintf_s(candidates[i][2], 264, "__imp_%s", name);
+        sprintf_s(candidates[i][3], 264, "__imp__%s", name);
+        for (int v = 0; v < NUM_VARIANTS; ++v) hashes[i][v] = fnv1a_hash(candidates[i][v]);
+        found_lib[i] = -1;
+    }
+
+    // 索引を走査する (検索パス順なので最初に見つかったライブラリを採用)。
+    // 1巡目は包括ライブラリを飛ばし、残ったシンボルだけ2巡目で包括ライブラリから探す
+    int num_unresolved = num_symbols;
+    for (int l = 0; l < index->num_libs * 2 && num_unresolved > 0; ++l) {
+        BOOL umbrella_pass = (l >= index->num_libs);
+        const LibraryEntry* entry = &index->libs[umbrella_pass ? l - index->num_libs : l];
+        if (is_runtime_library(entry->lname) || is_umbrella_library(entry->lname) != umbrella_pass) continue;
+        wchar_t flag[72];
+        swprintf_s(flag, 72, L"-l%S", entry->lname);
+        if (contains_flag_token(lib_flags, flag)) continue;
+        for (DWORD pos = 0; pos < entry->symbols_size; ) {
+            const char* symbol = entry->symbols + pos;
+            pos += (DWORD)strlen(symbol) + 1;
+            DWORD hash = fnv1a_hash(symbol);
+            for (int i = 0; i < num_symbols; ++i) {
+                if (found_lib[i] >= 0) continue;
+                for (int v = 0; v < NUM_VARIANTS; ++v) {
+                    if (hashes[i][v] == hash && strcmp(candidates[i][v], symbol) == 0) { found_lib[i] = (int)(entry - index->libs); num_unresolved--; break; }
+                }
+            }
+        }
+    }
+
+    int num_added = 0;
+    for (int i = 0; i < num_symbols; ++i) {
+        if (found_lib[i] < 0) continue;
+        ResolvedSymbol* r = &resolved[*num_resolved];
+        strcpy_s(r->symbol, sizeof(r->symbol), symbols[i]);
+        swprintf_s(r->flag, 72, L"-l%S", index->libs[found_lib[i]].lname);
+        if (!contains_flag_token(resolved_libs, r->flag)) {
+            // 一覧に収まらないライブラリは今回は追加しない
+            if (wcslen(resolved_libs) + wcslen(r->flag) + 1 >= resolved_libs_size) continue;
+            wcscat_s(resolved_libs, resolved_libs_size, L" ");
+            wcscat_s(resolved_libs, resolved_libs_size, r->flag);
+            num_added++;
+        }
+        (*num_resolved)++;
+    }
+    free(symbols); free(candidates); free(hashes); free(found_lib);
+    return num_added;
+}
+
+// 再リンクの結果から、実際に未定義シンボルを減らしたライブラリだけを " -lfoo" の形で書き出す
+// (そのライブラリのために選んだシンボルのどれかが、再リンクで未定義でなくなっていれば有効とみなす)
+void get_effective_libraries(const ResolvedSymbol* resolved, int num_resolved, const wchar_t* relink_output,
+                             wchar_t* effective_libs, size_t effective_libs_size) {
+    effective_libs[0] = L'\0';
+    char (*remaining)[256] = (char (*)[256])malloc(MAX_UNDEFINED_SYMBOLS * 256);
+    if (!remaining) return;
+    int num_remaining = collect_undefined_symbols(relink_output, remaining, MAX_UNDEFINED_SYMBOLS);
+    for (int i = 0; i < num_resolved; ++i) {
+        BOOL still_undefined = FALSE;
+        for (int j = 0; j < num_remaining && !still_undefined; ++j) still_undefined = (strcmp(remaining[j], resolved[i].symbol) == 0);
+        if (still_undefined || contains_flag_token(effective_libs, resolved[i].flag)) continue;
+        if (wcslen(effective_libs) + wcslen(resolved[i].flag) + 1 >= effective_libs_size) continue;
+        wcscat_s(effective_libs, effective_libs_size, L" ");
+        wcscat_s(effective_libs, effective_libs_size, resolved[i].flag);
+    }
+    free(remaining);
+}
+
+// 索引のメモリを解放する
+void free_symbol_index(SymbolIndex* index) {
+    for (int i = 0; i < index->num_libs; ++i) free(index->libs[i].symbols);
+    free(index->libs);
+    index->libs = NULL;
+    index->num_libs = index->capacity = 0;
+}
@@ -0,0 +1,15 @@
+#include <windows.h>
+#include <mmsystem.h>
+#include <stdio.h>
+
+// timeGetTime is exported by winmm, which is not in crun's header table.
+// The first link fails with an undefined reference; crun should find
+// -lwinmm in the symbol index, relink once and save it to crun_profile.ini.
+
+int main() {
+    DWORD start = timeGetTime();
+    Sleep(10);
+    DWORD elapsed = timeGetTime() - start;
+    printf("timeGetTime() works. Slept for about %lu ms.\n", (unsigned long)elapsed);
+    return 0;
+}